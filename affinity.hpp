@@ -0,0 +1,135 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/*
+    CPU placement and scheduling class for one thread. Settings the kernel
+    refuses (typically EPERM without CAP_SYS_NICE / CAP_IPC_LOCK) are reported
+    and skipped, the run continues with whatever was accepted.
+*/
+struct ThreadPolicy {
+    std::vector<int> cpus;
+    bool setScheduler = false;
+    int policy = SCHED_OTHER;
+    int priority = 0;
+    bool setNice = false;
+    int nice = 0;
+
+    // "3", "2-5", "1+3+5" or combinations such as "0-1+4"
+    static bool parseCpuList(const std::string& str, std::vector<int>& cpus) {
+        size_t start = 0;
+        while (start <= str.size()) {
+            size_t end = str.find('+', start);
+            if (end == std::string::npos) {
+                end = str.size();
+            }
+            const std::string item = str.substr(start, end - start);
+            int first, last;
+            char trailing;
+            const int fields = sscanf(item.c_str(), "%d-%d%c", &first, &last, &trailing);
+            if (fields == 1 && sscanf(item.c_str(), "%d%c", &first, &trailing) == 1) {
+                last = first;
+            } else if (fields != 2) {
+                return false;
+            }
+            if (first < 0 || last < first || last >= CPU_SETSIZE) {
+                return false;
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+            start = end + 1;
+        }
+        return !cpus.empty();
+    }
+
+    static bool parsePolicy(const std::string& str, int& policy) {
+        if (str == "fifo") {
+            policy = SCHED_FIFO;
+        } else if (str == "rr") {
+            policy = SCHED_RR;
+        } else if (str == "other") {
+            policy = SCHED_OTHER;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool empty() const {
+        return cpus.empty() && !setScheduler && !setNice;
+    }
+
+    // Applies to the calling thread. Returns false if any setting was refused.
+    bool apply(const char* name) const {
+        bool accepted = true;
+
+        if (!cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : cpus) {
+                CPU_SET(cpu, &set);
+            }
+            int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (err != 0) {
+                LOG("%s: pinning to %zu cpu(s) refused: %s\n", name, cpus.size(), strerror(err));
+                accepted = false;
+            } else {
+                LOG("%s: pinned to cpu %d%s\n", name, cpus[0], cpus.size() > 1 ? " (+more)" : "");
+            }
+        }
+
+        if (setScheduler) {
+            struct sched_param param = {};
+            param.sched_priority = priority;
+            int err = pthread_setschedparam(pthread_self(), policy, &param);
+            if (err != 0) {
+                LOG("%s: scheduling policy %d priority %d refused: %s\n", name, policy, priority, strerror(err));
+                accepted = false;
+            } else {
+                LOG("%s: scheduling policy %d priority %d\n", name, policy, priority);
+            }
+        }
+
+        if (setNice) {
+            // On Linux the nice value is per thread when addressed by tid
+            pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+            if (setpriority(PRIO_PROCESS, tid, nice) != 0) {
+                LOG("%s: nice %d refused: %s\n", name, nice, strerror(errno));
+                accepted = false;
+            } else {
+                LOG("%s: nice %d\n", name, nice);
+            }
+        }
+
+        return accepted;
+    }
+};
+
+// Keep current and future pages resident so page faults do not land in the measured window
+inline bool lockMemory() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        LOG("mlockall refused: %s\n", strerror(errno));
+        return false;
+    }
+    LOG("Memory locked\n");
+    return true;
+}
@@ -0,0 +1,248 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+    Classifies every job against the jobs of lower priority that overlap it:
+    not contended, preempted (a lower priority job was submitted before it
+    and completed after it, so it ran in the middle of that job) or
+    serialized (it overlapped lower priority work but did not run inside a
+    single job of it). For every job of a higher priority than some other
+    participant it reports the latency from submit to start. For each
+    preemption it reports how much longer the preempted job took than that
+    participant's median uncontended job.
+
+    Every priority level is indexed with its jobs sorted by submit time, a
+    running maximum of completion times over that order, and the completion
+    times sorted on their own. Overlap and containment are then binary
+    searches, so millions of intervals from soak runs take O(n log n).
+*/
+class OverlapAnalysis {
+public:
+    enum class Contention { None, Preempted, Serialized };
+
+    struct Job {
+        unsigned participant;
+        int priority;
+        uint64_t submit;
+        uint64_t start;     // start of execution, submit when not known
+        uint64_t end;
+    };
+
+    struct Event {
+        size_t job;
+        Contention contention;
+        size_t preempted;           // job it ran inside, with Contention::Preempted
+        uint64_t latencyNs;         // submit to start
+        int64_t inflationNs;        // preempted job over its participant's median uncontended job
+    };
+
+private:
+    struct Level {
+        int priority;
+        std::vector<size_t> bySubmit;       // job indices in submit order
+        std::vector<uint64_t> submits;      // submit times in that order
+        std::vector<uint64_t> maxEnd;       // running maximum of end times in that order
+        std::vector<size_t> maxEndJob;      // job with that end time
+        std::vector<uint64_t> ends;         // end times, sorted
+    };
+
+    std::vector<std::string> m_participants;
+    std::vector<Job> m_jobs;
+    std::vector<Level> m_levels;            // ascending priority
+    std::vector<Event> m_events;
+    std::vector<uint64_t> m_baselineNs;     // per participant, 0 without an uncontended job
+
+    void buildIndex() {
+        m_levels.clear();
+        for (auto const& job : m_jobs) {
+            auto it = std::find_if(m_levels.begin(), m_levels.end(), [&](Level const& l) { return l.priority == job.priority; });
+            if (it == m_levels.end()) {
+                m_levels.push_back(Level());
+                m_levels.back().priority = job.priority;
+            }
+        }
+        std::sort(m_levels.begin(), m_levels.end(), [](Level const& a, Level const& b) { return a.priority < b.priority; });
+
+        for (size_t i = 0; i < m_jobs.size(); i++) {
+            level(m_jobs[i].priority).bySubmit.push_back(i);
+        }
+        for (auto& l : m_levels) {
+            std::sort(l.bySubmit.begin(), l.bySubmit.end(), [&](size_t a, size_t b) { return m_jobs[a].submit < m_jobs[b].submit; });
+            for (size_t i : l.bySubmit) {
+                l.submits.push_back(m_jobs[i].submit);
+                l.ends.push_back(m_jobs[i].end);
+                if (l.maxEnd.empty() || m_jobs[i].end > l.maxEnd.back()) {
+                    l.maxEnd.push_back(m_jobs[i].end);
+                    l.maxEndJob.push_back(i);
+                } else {
+                    l.maxEnd.push_back(l.maxEnd.back());
+                    l.maxEndJob.push_back(l.maxEndJob.back());
+                }
+            }
+            std::sort(l.ends.begin(), l.ends.end());
+        }
+    }
+
+    Level& level(int priority) {
+        return *std::find_if(m_levels.begin(), m_levels.end(), [&](Level const& l) { return l.priority == priority; });
+    }
+
+    // Number of jobs of the level that overlap [begin, end)
+    static size_t overlapping(Level const& l, uint64_t begin, uint64_t end) {
+        const size_t started = std::lower_bound(l.submits.begin(), l.submits.end(), end) - l.submits.begin();
+        const size_t finished = std::upper_bound(l.ends.begin(), l.ends.end(), begin) - l.ends.begin();
+        return started - std::min(started, finished);
+    }
+
+    // Classifies job against the levels [first, last)
+    Contention classify(Job const& job, size_t first, size_t last, size_t* containing) const {
+        bool contended = false;
+        uint64_t bestEnd = 0;
+        *containing = SIZE_MAX;
+
+        for (size_t i = first; i < last; i++) {
+            Level const& l = m_levels[i];
+            if (overlapping(l, job.submit, job.end) == 0) {
+                continue;
+            }
+            contended = true;
+            // The latest finishing job among those submitted strictly before this one
+            const size_t before = std::lower_bound(l.submits.begin(), l.submits.end(), job.submit) - l.submits.begin();
+            if (before > 0 && l.maxEnd[before - 1] > job.end && l.maxEnd[before - 1] > bestEnd) {
+                bestEnd = l.maxEnd[before - 1];
+                *containing = l.maxEndJob[before - 1];
+            }
+        }
+        if (*containing != SIZE_MAX) {
+            return Contention::Preempted;
+        }
+        return contended ? Contention::Serialized : Contention::None;
+    }
+
+    static uint64_t percentile(std::vector<uint64_t> values, double p) {
+        if (values.empty()) {
+            return 0;
+        }
+        const size_t k = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+
+public:
+    // Returns the participant id for add()
+    unsigned addParticipant(std::string const& label) {
+        m_participants.push_back(label);
+        return m_participants.size() - 1;
+    }
+
+    void add(unsigned participant, int priority, uint64_t submit, uint64_t start, uint64_t end) {
+        m_jobs.push_back({participant, priority, submit, std::min(std::max(start, submit), end), end});
+    }
+
+    size_t jobCount() const { return m_jobs.size(); }
+    Job const& job(size_t i) const { return m_jobs[i]; }
+    std::vector<Event> const& events() const { return m_events; }
+
+    void run() {
+        buildIndex();
+        m_events.clear();
+
+        // Baseline: median duration of the jobs no higher priority job overlapped
+        std::vector<std::vector<uint64_t>> uncontended(m_participants.size());
+        for (size_t i = 0; i < m_jobs.size(); i++) {
+            Job const& job = m_jobs[i];
+            const size_t own = &level(job.priority) - m_levels.data();
+            size_t containing;
+            if (classify(job, own + 1, m_levels.size(), &containing) == Contention::None) {
+                uncontended[job.participant].push_back(job.end - job.submit);
+            }
+        }
+        m_baselineNs.assign(m_participants.size(), 0);
+        for (size_t p = 0; p < m_participants.size(); p++) {
+            m_baselineNs[p] = percentile(uncontended[p], 0.5);
+        }
+
+        // Events: every job above the lowest priority level
+        for (size_t i = 0; i < m_jobs.size(); i++) {
+            Job const& job = m_jobs[i];
+            const size_t own = &level(job.priority) - m_levels.data();
+            if (own == 0) {
+                continue;
+            }
+            Event event;
+            event.job = i;
+            event.contention = classify(job, 0, own, &event.preempted);
+            event.latencyNs = job.start - job.submit;
+            event.inflationNs = 0;
+            if (event.contention == Contention::Preempted && m_baselineNs[m_jobs[event.preempted].participant]) {
+                Job const& low = m_jobs[event.preempted];
+                event.inflationNs = static_cast<int64_t>(low.end - low.submit) - static_cast<int64_t>(m_baselineNs[low.participant]);
+            }
+            m_events.push_back(event);
+        }
+    }
+
+    // Per participant summary, and every event when there are at most maxEvents
+    void print(size_t maxEvents = 32) const {
+        static const char* names[] = { "not contended", "preempted", "serialized" };
+
+        LOG("Overlap analysis: %zu jobs, %zu participants, %zu priority levels\n",
+            m_jobs.size(), m_participants.size(), m_levels.size());
+        for (size_t p = 0; p < m_participants.size(); p++) {
+            size_t counts[3] = { 0, 0, 0 };
+            std::vector<uint64_t> latencies, preemptLatencies;
+            std::vector<uint64_t> inflations;
+            for (auto const& event : m_events) {
+                if (m_jobs[event.job].participant != p) {
+                    continue;
+                }
+                counts[static_cast<int>(event.contention)]++;
+                latencies.push_back(event.latencyNs);
+                if (event.contention == Contention::Preempted) {
+                    preemptLatencies.push_back(event.latencyNs);
+                    inflations.push_back(std::max<int64_t>(event.inflationNs, 0));
+                }
+            }
+            if (latencies.empty()) {
+                LOG("  %s: lowest priority, baseline %lu ns\n", m_participants[p].c_str(), m_baselineNs[p]);
+                continue;
+            }
+            LOG("  %s: %zu not contended, %zu preempted, %zu serialized\n",
+                m_participants[p].c_str(), counts[0], counts[1], counts[2]);
+            LOG("  %s: submit to start p50 %lu ns, p99 %lu ns, max %lu ns\n", m_participants[p].c_str(),
+                percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 1.0));
+            if (!preemptLatencies.empty()) {
+                LOG("  %s: preemption latency p50 %lu ns, p99 %lu ns, max %lu ns; low priority inflation p50 %lu ns, max %lu ns\n",
+                    m_participants[p].c_str(), percentile(preemptLatencies, 0.5), percentile(preemptLatencies, 0.99),
+                    percentile(preemptLatencies, 1.0), percentile(inflations, 0.5), percentile(inflations, 1.0));
+            }
+        }
+
+        if (m_events.size() > maxEvents) {
+            return;
+        }
+        for (auto const& event : m_events) {
+            Job const& job = m_jobs[event.job];
+            if (event.contention == Contention::Preempted) {
+                Job const& low = m_jobs[event.preempted];
+                LOG("  %s [%lu, %lu]: preempted %s [%lu, %lu], latency %lu ns, inflation %ld ns\n",
+                    m_participants[job.participant].c_str(), job.submit, job.end,
+                    m_participants[low.participant].c_str(), low.submit, low.end, event.latencyNs, event.inflationNs);
+            } else {
+                LOG("  %s [%lu, %lu]: %s, latency %lu ns\n", m_participants[job.participant].c_str(),
+                    job.submit, job.end, names[static_cast<int>(event.contention)], event.latencyNs);
+            }
+        }
+    }
+};
@@ -8,15 +8,26 @@
 
 #include <vulkan/vulkan.h>
 #include "VulkanTools.h"
+#include "logger.hpp"
+#include "memory.hpp"
+#include "progress.hpp"
+#include "pipelinestats.hpp"
 
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <string>
 #include <utility>
+#include <vector>
+
+#include <time.h>
 
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
 #define LOG(...) ((void)__android_log_print(ANDROID_LOG_INFO, "vulkanExample", __VA_ARGS__))
 #else
-#define LOG(...) { printf(__VA_ARGS__); fflush(stdout); }
+#define LOG(...) LOG_INFO(__VA_ARGS__)
 #endif
 
 struct QueueInfo {
@@ -25,12 +36,168 @@ struct QueueInfo {
     VkQueue queue;
     uint32_t familyIndex;
     unsigned offset;
+    uint32_t timestampValidBits;    // of the family, 0 without timestamp support
+};
+
+inline uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// A recorded command buffer ready for vkQueueSubmit, together with the CPU
+// times (CLOCK_MONOTONIC ns) at which it was handed off and actually submitted.
+struct Submission {
+    VkQueue queue;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    uint64_t enqueueTime;
+    uint64_t submitTime;
+};
+
+/*
+    Command buffers, fences and timestamp query pools for up to depth
+    submissions of a workload in flight. Submission i runs on frame i % depth;
+    acquire() waits for the submission that used the frame before, so the
+    queue can hold depth submissions of one workload at once. With
+    resetQueryPool (VK_EXT_host_query_reset) acquire() also resets the queries
+    of the frame from the host, otherwise the command buffers have to. With
+    statistics every frame also gets a pipeline statistics query of those.
+*/
+class FrameRing {
+public:
+    struct Frame {
+        VkCommandBuffer commandBuffer;
+        VkFence fence;
+        VkQueryPool queryPool;
+        VkQueryPool statisticsPool;     // VK_NULL_HANDLE without statistics
+    };
+
+private:
+    VkDevice m_device = VK_NULL_HANDLE;
+    PFN_vkResetQueryPoolEXT m_resetQueryPool = nullptr;
+    uint32_t m_queries = 0;
+    VkQueryPipelineStatisticFlags m_statistics = 0;
+    std::vector<Frame> m_frames;
+    unsigned m_submitted = 0;
+
+public:
+    FrameRing() {}
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    // The command buffers are freed with commandPool; the fences start signaled
+    void create(VkDevice device, VkCommandPool commandPool, unsigned depth, uint32_t queries,
+        PFN_vkResetQueryPoolEXT resetQueryPool = nullptr, VkQueryPipelineStatisticFlags statistics = 0) {
+        m_device = device;
+        m_resetQueryPool = resetQueryPool;
+        m_queries = queries;
+        m_statistics = statistics;
+        m_frames.resize(std::max(depth, 1u));
+        std::vector<VkCommandBuffer> commandBuffers(m_frames.size());
+        VkCommandBufferAllocateInfo allocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool,
+            VK_COMMAND_BUFFER_LEVEL_PRIMARY, static_cast<uint32_t>(commandBuffers.size()));
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(m_device, &allocateInfo, commandBuffers.data()));
+
+        VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = queries;
+        VkQueryPoolCreateInfo statisticsPoolInfo = {};
+        statisticsPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        statisticsPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        statisticsPoolInfo.queryCount = 1;
+        statisticsPoolInfo.pipelineStatistics = statistics;
+        for (size_t i = 0; i < m_frames.size(); i++) {
+            m_frames[i].commandBuffer = commandBuffers[i];
+            m_frames[i].statisticsPool = VK_NULL_HANDLE;
+            VK_CHECK_RESULT(vkCreateFence(m_device, &fenceInfo, nullptr, &m_frames[i].fence));
+            VK_CHECK_RESULT(vkCreateQueryPool(m_device, &queryPoolInfo, nullptr, &m_frames[i].queryPool));
+            if (statistics) {
+                VK_CHECK_RESULT(vkCreateQueryPool(m_device, &statisticsPoolInfo, nullptr, &m_frames[i].statisticsPool));
+            }
+        }
+    }
+
+    ~FrameRing() {
+        for (auto const& frame : m_frames) {
+            vkDestroyFence(m_device, frame.fence, nullptr);
+            vkDestroyQueryPool(m_device, frame.queryPool, nullptr);
+            vkDestroyQueryPool(m_device, frame.statisticsPool, nullptr);
+        }
+    }
+
+    unsigned depth() const { return m_frames.size(); }
+    uint32_t queries() const { return m_queries; }
+    bool hostQueryReset() const { return m_resetQueryPool != nullptr; }
+    VkQueryPipelineStatisticFlags statistics() const { return m_statistics; }
+    Frame& operator[](unsigned frame) { return m_frames[frame]; }
+    std::vector<Frame>::iterator begin() { return m_frames.begin(); }
+    std::vector<Frame>::iterator end() { return m_frames.end(); }
+
+    // The frame for the next submission, once its previous submission completed, with the fence reset
+    unsigned acquire() {
+        const unsigned frame = m_submitted++ % m_frames.size();
+        VK_CHECK_RESULT(vkWaitForFences(m_device, 1, &m_frames[frame].fence, VK_TRUE, UINT64_MAX));
+        VK_CHECK_RESULT(vkResetFences(m_device, 1, &m_frames[frame].fence));
+        if (m_resetQueryPool) {
+            m_resetQueryPool(m_device, m_frames[frame].queryPool, 0, m_queries);
+            if (m_statistics) {
+                m_resetQueryPool(m_device, m_frames[frame].statisticsPool, 0, 1);
+            }
+        }
+        return frame;
+    }
+
+    // The frame of the latest submission
+    unsigned last() const {
+        return (m_submitted + m_frames.size() - 1) % m_frames.size();
+    }
+
+    void wait() {
+        std::vector<VkFence> fences;
+        for (auto const& frame : m_frames) {
+            fences.push_back(frame.fence);
+        }
+        VK_CHECK_RESULT(vkWaitForFences(m_device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX));
+    }
 };
 
 class Workload {
 public:
-    virtual VkFence submit() = 0;
-    virtual void queryTimestamp(uint64_t time_stamp[], int count) = 0;
+    virtual ~Workload() {}
+
+    // Takes the next frame, waiting for it if all of them are in flight, and returns the submission
+    // without submitting it
+    virtual Submission prepareSubmit() = 0;
+
+    virtual VkFence submit() {
+        Submission submission = prepareSubmit();
+        VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &submission.commandBuffer;
+        VK_CHECK_RESULT(vkQueueSubmit(submission.queue, 1, &submitInfo, submission.fence));
+        return submission.fence;
+    }
+
+    // Submissions that can be in flight at once
+    virtual unsigned depth() const = 0;
+    virtual unsigned lastFrame() const = 0;
+
+    // Timestamps of the latest submission on frame
+    virtual void queryTimestamp(unsigned frame, uint64_t time_stamp[], int count) = 0;
+
+    // Progress curve of the latest submission on frame, empty without progress marks; does not wait
+    virtual ProgressCurve queryProgress(unsigned frame, double timestampPeriod) = 0;
+
+    // Pipeline statistics of the latest submission on frame, empty without them; does not wait
+    virtual PipelineStatistics queryStatistics(unsigned frame) = 0;
+
+    void queryTimestamp(uint64_t time_stamp[], int count) {
+        queryTimestamp(lastFrame(), time_stamp, count);
+    }
+
     virtual void waitIdle() = 0;
 };
 
@@ -41,10 +208,17 @@ class Base {
     VkPhysicalDeviceProperties m_deviceProperties;
     std::map<VkQueueGlobalPriorityEXT, QueueInfo> m_graphicQueues;
     std::map<VkQueueGlobalPriorityEXT, QueueInfo> m_computeQueues;
+    std::map<VkQueueGlobalPriorityEXT, QueueInfo> m_transferQueues;
+    std::map<VkQueue, std::unique_ptr<std::mutex>> m_queueMutexes;
+    std::set<std::string> m_deviceExtensions;
+    std::unique_ptr<MemoryTracker> m_memoryTracker;
+    PFN_vkResetQueryPoolEXT m_resetQueryPool = nullptr;
+    bool m_pipelineStatistics = false;
 
     std::map<VkQueueGlobalPriorityEXT, QueueInfo>& GetQueueInfos(VkQueueFlagBits type) {
         switch(type) {
         case VK_QUEUE_COMPUTE_BIT: return m_computeQueues;
+        case VK_QUEUE_TRANSFER_BIT: return m_transferQueues;
         case VK_QUEUE_GRAPHICS_BIT: return m_graphicQueues;
         default: LOG("Unsupported queue type\n");
         }
@@ -67,8 +241,32 @@ public:
     QueueInfo const& GetQueueInfo(VkQueueFlagBits type, VkQueueGlobalPriorityEXT priority) {
         return GetQueueInfos(type).at(priority);
     }
+    bool HasQueue(VkQueueFlagBits type, VkQueueGlobalPriorityEXT priority) {
+        return GetQueueInfos(type).count(priority) != 0;
+    }
+    // Held around vkQueueSubmit by anything that may run concurrently on the queue, e.g. parallel uploads
+    std::mutex& GetQueueMutex(VkQueue queue) {
+        return *m_queueMutexes.at(queue);
+    }
+    // Optional device extensions are enabled when the device supports them
+    bool IsDeviceExtensionEnabled(const char* name) const {
+        return m_deviceExtensions.count(name) != 0;
+    }
+    // Workloads allocate device memory through it
+    MemoryTracker& GetMemoryTracker() {
+        return *m_memoryTracker;
+    }
+    // vkResetQueryPoolEXT with VK_EXT_host_query_reset and its feature, nullptr without
+    PFN_vkResetQueryPoolEXT GetHostQueryReset() const {
+        return m_resetQueryPool;
+    }
+    // The pipelineStatisticsQuery feature is enabled when the device has it
+    bool HasPipelineStatistics() const {
+        return m_pipelineStatistics;
+    }
 
-    Base(std::vector<VkQueueGlobalPriorityEXT> graphicPriorities, std::vector<VkQueueGlobalPriorityEXT> computePriorities)
+    Base(std::vector<VkQueueGlobalPriorityEXT> graphicPriorities, std::vector<VkQueueGlobalPriorityEXT> computePriorities,
+        std::vector<VkQueueGlobalPriorityEXT> transferPriorities = {})
     {
 		LOG("Create a device\n");
 
@@ -81,7 +279,7 @@ public:
 		appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
 		appInfo.pApplicationName = "Vulkan headless example";
 		appInfo.pEngineName = "ComputeWork";
-		appInfo.apiVersion = VK_API_VERSION_1_0;
+		appInfo.apiVersion = VK_API_VERSION_1_1;
 
 		/*
 			Vulkan instance creation (without surface extensions)
@@ -189,12 +387,34 @@ public:
         }
 
         auto addQueue = [&](VkQueueFlagBits type, VkQueueGlobalPriorityEXT globalPriority) {
-            for (uint32_t i = type - 1; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
-                printf("addQueue queueFamilyNextOffset:%d queueCount:%d queueFlags:%08x queuetype:%d\n",
+            // Transfer queues come from transfer-only families (DMA engines) first; graphics and compute
+            // families support transfers too, whether they report the bit or not. Transfers are timed, so
+            // families with timestamps go first and the others only when nothing else is left.
+            std::vector<uint32_t> families;
+            VkQueueFlags accepted = type;
+            if (type == VK_QUEUE_TRANSFER_BIT) {
+                accepted = VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+                for (bool timestamps : { true, false }) {
+                    for (bool transferOnly : { true, false }) {
+                        for (uint32_t i = 0; i < static_cast<uint32_t>(familyCount); i++) {
+                            if (!(queueFamilyProperties[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == transferOnly
+                                && (queueFamilyProperties[i].timestampValidBits != 0) == timestamps) {
+                                families.push_back(i);
+                            }
+                        }
+                    }
+                }
+            } else {
+                for (uint32_t i = type - 1; i < static_cast<uint32_t>(familyCount); i++) {
+                    families.push_back(i);
+                }
+            }
+            for (uint32_t i : families) {
+                LOG("addQueue queueFamilyNextOffset:%d queueCount:%d queueFlags:%08x queuetype:%d\n",
                     queueFamilyNextOffset[i], queueFamilyProperties[i].queueCount,
                     queueFamilyProperties[i].queueFlags, type);
                 if ((queueFamilyNextOffset[i] < queueFamilyProperties[i].queueCount)
-                    && (queueFamilyProperties[i].queueFlags & type))
+                    && (queueFamilyProperties[i].queueFlags & accepted))
                 {
                     auto& queueCreateInfo = queueCreateInfos[i];
                     auto& queuePriorityCreateInfo = queuePriorityCreateInfos[i];
@@ -209,6 +429,7 @@ public:
                         auto& queueInfo = CreateQueueInfo(type, globalPriority);
                         queueInfo.offset = queueFamilyNextOffset[i];
                         queueInfo.familyIndex = i;
+                        queueInfo.timestampValidBits = queueFamilyProperties[i].timestampValidBits;
 
                         queueCreateInfos[i].queueCount = queueFamilyProperties[i].queueCount;
                         if (globalPriority == VkQueueGlobalPriorityEXT::VK_QUEUE_GLOBAL_PRIORITY_REALTIME_EXT
@@ -235,16 +456,68 @@ public:
         for (auto priority : computePriorities) {
             addQueue(VK_QUEUE_COMPUTE_BIT, priority);
         }
+        for (auto priority : transferPriorities) {
+            addQueue(VK_QUEUE_TRANSFER_BIT, priority);
+        }
+
+        // Optional device extensions
+        const std::vector<const char*> optionalExtensions = {
+            VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME,
+            VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+            VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME
+        };
+        uint32_t extensionCount = 0;
+        VK_CHECK_RESULT(vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionCount, nullptr));
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        VK_CHECK_RESULT(vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionCount, extensions.data()));
+        std::vector<const char*> enabledExtensions;
+        // Host query reset is only usable with its feature
+        VkPhysicalDeviceHostQueryResetFeaturesEXT hostQueryResetFeatures = {};
+        hostQueryResetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES_EXT;
+        VkPhysicalDeviceFeatures2 features = {};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &hostQueryResetFeatures;
+        vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features);
+        for (auto name : optionalExtensions) {
+            if (strcmp(name, VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME) == 0 && !hostQueryResetFeatures.hostQueryReset) {
+                continue;
+            }
+            for (auto const& extension : extensions) {
+                if (strcmp(extension.extensionName, name) == 0) {
+                    enabledExtensions.push_back(name);
+                    m_deviceExtensions.insert(name);
+                    LOG("Enabled %s\n", name);
+                    break;
+                }
+            }
+        }
 
 		// Create logical device
 		VkDeviceCreateInfo deviceCreateInfo = {};
 		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 		deviceCreateInfo.queueCreateInfoCount = queueCreateInfos.size();
 		deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+		deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
+        VkPhysicalDeviceFeatures enabledFeatures = {};
+        enabledFeatures.pipelineStatisticsQuery = features.features.pipelineStatisticsQuery;
+        m_pipelineStatistics = enabledFeatures.pipelineStatisticsQuery == VK_TRUE;
+        deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
+        if (IsDeviceExtensionEnabled(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME)) {
+            hostQueryResetFeatures.pNext = nullptr;
+            deviceCreateInfo.pNext = &hostQueryResetFeatures;
+        }
 		VK_CHECK_RESULT(vkCreateDevice(m_physicalDevice, &deviceCreateInfo, nullptr, &m_device));
+        if (IsDeviceExtensionEnabled(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME)) {
+            m_resetQueryPool = reinterpret_cast<PFN_vkResetQueryPoolEXT>(vkGetDeviceProcAddr(m_device, "vkResetQueryPoolEXT"));
+        }
+        m_memoryTracker.reset(new MemoryTracker(m_physicalDevice, IsDeviceExtensionEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)));
 
         auto getQueue = [&](QueueInfo& queueInfo) {
             vkGetDeviceQueue(m_device, queueInfo.familyIndex, queueInfo.offset, &queueInfo.queue);
+            if (!m_queueMutexes.count(queueInfo.queue)) {
+                m_queueMutexes[queueInfo.queue].reset(new std::mutex);
+            }
         };
 
         LOG("Graphic queues : %zu\n", m_graphicQueues.size());
@@ -260,6 +533,14 @@ public:
             getQueue(queueInfo);
             LOG(" [%p] familyIndex %d, priority %d\n", queueInfo.queue, queueInfo.familyIndex, queueInfo.priority);
         }
+
+        LOG("Transfer queues : %zu\n", m_transferQueues.size());
+        for (auto& item: m_transferQueues) {
+            auto& queueInfo = item.second;
+            getQueue(queueInfo);
+            LOG(" [%p] familyIndex %d, priority %d, flags %08x\n", queueInfo.queue, queueInfo.familyIndex, queueInfo.priority,
+                queueFamilyProperties[queueInfo.familyIndex].queueFlags);
+        }
     }
 
     ~Base() {
@@ -0,0 +1,436 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+/*
+    Micro-benchmarks for every stage of vkpreemption: device creation,
+    pipeline creation, command recording, submission, host waits and
+    readback. Results go to stdout as CSV, one row per benchmark; everything
+    the tool itself logs is sent to stderr. Runs on any Vulkan 1.0 device,
+    including lavapipe (VK_ICD_FILENAMES=.../lvp_icd.x86_64.json).
+
+    Usage: vkpreemption_bench [filter]   runs the benchmarks whose name contains filter
+*/
+
+#include "../base.hpp"
+#include "../computework.hpp"
+#include "../graphicwork.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <unistd.h>
+
+namespace {
+
+const VkQueueGlobalPriorityEXT kPriority = VK_QUEUE_GLOBAL_PRIORITY_MEDIUM_EXT;
+
+FILE* g_results = stdout;
+const char* g_filter = "";
+
+struct Buffer {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+};
+
+uint32_t findMemoryType(Base& base, uint32_t typeBits, VkMemoryPropertyFlags properties) {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(base.GetPhysicalDevice(), &memoryProperties);
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    LOG("No memory type with properties %x\n", properties);
+    exit(-1);
+}
+
+Buffer createBuffer(Base& base, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkDeviceSize size) {
+    VkDevice device = base.GetDevice();
+    Buffer result;
+    VkBufferCreateInfo bufferInfo = vks::initializers::bufferCreateInfo(usage, size);
+    VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &result.buffer));
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(device, result.buffer, &memReqs);
+    VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = findMemoryType(base, memReqs.memoryTypeBits, properties);
+    VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &result.memory));
+    VK_CHECK_RESULT(vkBindBufferMemory(device, result.buffer, result.memory, 0));
+    return result;
+}
+
+void destroyBuffer(Base& base, Buffer& buffer) {
+    vkDestroyBuffer(base.GetDevice(), buffer.buffer, nullptr);
+    vkFreeMemory(base.GetDevice(), buffer.memory, nullptr);
+}
+
+// Runs body warmup + iterations times, each call returns one sample, and prints a CSV row
+void run(const char* name, const char* unit, unsigned warmup, unsigned iterations, std::function<double()> body) {
+    if (strstr(name, g_filter) == nullptr) {
+        return;
+    }
+    for (unsigned i = 0; i < warmup; i++) {
+        body();
+    }
+    std::vector<double> samples(iterations);
+    for (auto& sample : samples) {
+        sample = body();
+    }
+    std::sort(samples.begin(), samples.end());
+
+    double mean = 0.0;
+    for (auto sample : samples) {
+        mean += sample / samples.size();
+    }
+    fprintf(g_results, "%s,%s,%u,%.1f,%.1f,%.1f,%.1f,%.1f\n", name, unit, iterations,
+        samples.front(), samples[samples.size() / 2], samples[(samples.size() * 90) / 100], samples.back(), mean);
+    fflush(g_results);
+}
+
+class Bench {
+    Base& m_base;
+    VkDevice m_device;
+    QueueInfo m_queue;
+    VkCommandPool m_commandPool;
+
+public:
+    explicit Bench(Base& base)
+        : m_base(base)
+        , m_device(base.GetDevice())
+        , m_queue(base.GetQueueInfo(VK_QUEUE_GRAPHICS_BIT, kPriority))
+    {
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = m_queue.familyIndex;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VK_CHECK_RESULT(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool));
+    }
+
+    ~Bench() {
+        vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+    }
+
+    VkCommandBuffer allocate() {
+        VkCommandBuffer commandBuffer;
+        VkCommandBufferAllocateInfo allocInfo =
+            vks::initializers::commandBufferAllocateInfo(m_commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer));
+        return commandBuffer;
+    }
+
+    VkCommandBuffer emptyCommandBuffer() {
+        VkCommandBuffer commandBuffer = allocate();
+        VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+        VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+        return commandBuffer;
+    }
+
+    VkFence createFence() {
+        VkFence fence;
+        VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo();
+        VK_CHECK_RESULT(vkCreateFence(m_device, &fenceInfo, nullptr, &fence));
+        return fence;
+    }
+
+    void workloads() {
+        run("compute_work_create", "ns", 2, 20, [&]() {
+            const uint64_t start = monotonicNs();
+            ComputeWork work(m_base, m_queue, 1);
+            return double(monotonicNs() - start);
+        });
+        run("graphics_work_create", "ns", 2, 20, [&]() {
+            const uint64_t start = monotonicNs();
+            GraphicsWork work(m_base, m_queue, 1);
+            return double(monotonicNs() - start);
+        });
+    }
+
+    // vkCreateComputePipelines only, with an empty cache and with one primed by an identical pipeline
+    void pipelines() {
+        const uint32_t headless_comp[] = {
+            #include "../headless.comp.inc"
+        };
+        VkShaderModule module = vks::tools::loadShader(sizeof(headless_comp), headless_comp, m_device);
+
+        VkDescriptorSetLayoutBinding binding =
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0);
+        VkDescriptorSetLayoutCreateInfo layoutInfo = vks::initializers::descriptorSetLayoutCreateInfo(&binding, 1);
+        VkDescriptorSetLayout setLayout;
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &setLayout));
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = vks::initializers::pipelineLayoutCreateInfo(&setLayout, 1);
+        VkPipelineLayout pipelineLayout;
+        VK_CHECK_RESULT(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+
+        uint32_t elementCount = BUFFER_ELEMENTS;
+        VkSpecializationMapEntry mapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+        VkSpecializationInfo specializationInfo =
+            vks::initializers::specializationInfo(1, &mapEntry, sizeof(elementCount), &elementCount);
+        VkComputePipelineCreateInfo pipelineInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout, 0);
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = module;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+
+        VkPipelineCacheCreateInfo cacheInfo = {};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+        auto createPipeline = [&](VkPipelineCache cache) {
+            VkPipeline pipeline;
+            const uint64_t start = monotonicNs();
+            VK_CHECK_RESULT(vkCreateComputePipelines(m_device, cache, 1, &pipelineInfo, nullptr, &pipeline));
+            const uint64_t elapsed = monotonicNs() - start;
+            vkDestroyPipeline(m_device, pipeline, nullptr);
+            return double(elapsed);
+        };
+
+        run("pipeline_create_cold", "ns", 2, 50, [&]() {
+            VkPipelineCache cache;
+            VK_CHECK_RESULT(vkCreatePipelineCache(m_device, &cacheInfo, nullptr, &cache));
+            const double elapsed = createPipeline(cache);
+            vkDestroyPipelineCache(m_device, cache, nullptr);
+            return elapsed;
+        });
+
+        VkPipelineCache warm;
+        VK_CHECK_RESULT(vkCreatePipelineCache(m_device, &cacheInfo, nullptr, &warm));
+        createPipeline(warm);
+        run("pipeline_create_warm", "ns", 2, 50, [&]() {
+            return createPipeline(warm);
+        });
+
+        vkDestroyPipelineCache(m_device, warm, nullptr);
+        vkDestroyPipelineLayout(m_device, pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(m_device, setLayout, nullptr);
+        vkDestroyShaderModule(m_device, module, nullptr);
+    }
+
+    // Host cost of recording, per command, using the pipelines of the real workloads
+    void recording() {
+        const unsigned commands = 10000;
+        VkCommandBuffer commandBuffer = allocate();
+        VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+
+        GraphicsWork graphics(m_base, m_queue, 1);
+        run("record_draw", "ns/draw", 2, 20, [&]() {
+            const uint64_t start = monotonicNs();
+            VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+            VkClearValue clearValues[2];
+            clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 1.0f } };
+            clearValues[1].depthStencil = { 1.0f, 0 };
+            VkRenderPassBeginInfo renderPassBeginInfo = {};
+            renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassBeginInfo.renderArea.extent.width = graphics.width;
+            renderPassBeginInfo.renderArea.extent.height = graphics.height;
+            renderPassBeginInfo.clearValueCount = 2;
+            renderPassBeginInfo.pClearValues = clearValues;
+            renderPassBeginInfo.renderPass = graphics.renderPass;
+            renderPassBeginInfo.framebuffer = graphics.targets[0].framebuffer;
+            vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+            VkViewport viewport = { 0.0f, 0.0f, (float)graphics.width, (float)graphics.height, 0.0f, 1.0f };
+            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            VkRect2D scissor = {};
+            scissor.extent.width = graphics.width;
+            scissor.extent.height = graphics.height;
+            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
+            VkDeviceSize offsets[1] = { 0 };
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &graphics.vertexBuffer, offsets);
+            vkCmdBindIndexBuffer(commandBuffer, graphics.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+            const glm::mat4 mvpMatrix(1.0f);
+            for (unsigned i = 0; i < commands; i++) {
+                vkCmdPushConstants(commandBuffer, graphics.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mvpMatrix), &mvpMatrix);
+                vkCmdDrawIndexed(commandBuffer, 3, 1, 0, 0, 0);
+            }
+            vkCmdEndRenderPass(commandBuffer);
+            VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+            return double(monotonicNs() - start) / commands;
+        });
+
+        ComputeWork compute(m_base, m_queue, 1);
+        run("record_dispatch", "ns/dispatch", 2, 20, [&]() {
+            const uint64_t start = monotonicNs();
+            VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
+            for (unsigned i = 0; i < commands; i++) {
+                vkCmdDispatch(commandBuffer, BUFFER_ELEMENTS, 1, 1);
+            }
+            VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+            return double(monotonicNs() - start) / commands;
+        });
+
+        vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
+    }
+
+    // vkQueueSubmit call cost, and the host-observed round trip of an empty submission
+    // completed through a fence alone or behind a binary semaphore from a previous submission
+    void submission() {
+        VkCommandBuffer first = emptyCommandBuffer();
+        VkCommandBuffer second = emptyCommandBuffer();
+        VkFence fence = createFence();
+        VkSemaphore semaphore;
+        VkSemaphoreCreateInfo semaphoreInfo = vks::initializers::semaphoreCreateInfo();
+        VK_CHECK_RESULT(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &semaphore));
+
+        VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &first;
+
+        run("queue_submit", "ns", 10, 1000, [&]() {
+            const uint64_t start = monotonicNs();
+            VK_CHECK_RESULT(vkQueueSubmit(m_queue.queue, 1, &submitInfo, fence));
+            const uint64_t elapsed = monotonicNs() - start;
+            VK_CHECK_RESULT(vkWaitForFences(m_device, 1, &fence, VK_TRUE, UINT64_MAX));
+            VK_CHECK_RESULT(vkResetFences(m_device, 1, &fence));
+            return double(elapsed);
+        });
+
+        run("wait_fence", "ns", 10, 1000, [&]() {
+            const uint64_t start = monotonicNs();
+            VK_CHECK_RESULT(vkQueueSubmit(m_queue.queue, 1, &submitInfo, fence));
+            VK_CHECK_RESULT(vkWaitForFences(m_device, 1, &fence, VK_TRUE, UINT64_MAX));
+            const uint64_t elapsed = monotonicNs() - start;
+            VK_CHECK_RESULT(vkResetFences(m_device, 1, &fence));
+            return double(elapsed);
+        });
+
+        const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkSubmitInfo chain[2] = { vks::initializers::submitInfo(), vks::initializers::submitInfo() };
+        chain[0].commandBufferCount = 1;
+        chain[0].pCommandBuffers = &first;
+        chain[0].signalSemaphoreCount = 1;
+        chain[0].pSignalSemaphores = &semaphore;
+        chain[1].waitSemaphoreCount = 1;
+        chain[1].pWaitSemaphores = &semaphore;
+        chain[1].pWaitDstStageMask = &waitStage;
+        chain[1].commandBufferCount = 1;
+        chain[1].pCommandBuffers = &second;
+
+        run("wait_semaphore", "ns", 10, 1000, [&]() {
+            const uint64_t start = monotonicNs();
+            VK_CHECK_RESULT(vkQueueSubmit(m_queue.queue, 1, &chain[0], VK_NULL_HANDLE));
+            VK_CHECK_RESULT(vkQueueSubmit(m_queue.queue, 1, &chain[1], fence));
+            VK_CHECK_RESULT(vkWaitForFences(m_device, 1, &fence, VK_TRUE, UINT64_MAX));
+            const uint64_t elapsed = monotonicNs() - start;
+            VK_CHECK_RESULT(vkResetFences(m_device, 1, &fence));
+            return double(elapsed);
+        });
+
+        vkDestroySemaphore(m_device, semaphore, nullptr);
+        vkDestroyFence(m_device, fence, nullptr);
+        VkCommandBuffer commandBuffers[] = { first, second };
+        vkFreeCommandBuffers(m_device, m_commandPool, 2, commandBuffers);
+    }
+
+    // Device-local to host-visible copy, invalidate and memcpy into host memory
+    void readback() {
+        const VkDeviceSize sizes[] = { 1 << 20, 16 << 20, 64 << 20 };
+
+        for (VkDeviceSize size : sizes) {
+            Buffer source = createBuffer(m_base, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, size);
+            Buffer staging = createBuffer(m_base, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, size);
+            std::vector<char> host(size);
+
+            VkCommandBuffer commandBuffer = allocate();
+            VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+            VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+            vkCmdFillBuffer(commandBuffer, source.buffer, 0, VK_WHOLE_SIZE, 0x5a5a5a5a);
+            VkBufferMemoryBarrier barrier = vks::initializers::bufferMemoryBarrier();
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.buffer = source.buffer;
+            barrier.size = VK_WHOLE_SIZE;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_FLAGS_NONE, 0, nullptr, 1, &barrier, 0, nullptr);
+            VkBufferCopy copyRegion = {};
+            copyRegion.size = size;
+            vkCmdCopyBuffer(commandBuffer, source.buffer, staging.buffer, 1, &copyRegion);
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            barrier.buffer = staging.buffer;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                VK_FLAGS_NONE, 0, nullptr, 1, &barrier, 0, nullptr);
+            VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+            VkFence fence = createFence();
+            VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &commandBuffer;
+
+            const std::string name = "readback_" + std::to_string(size >> 20) + "MiB";
+            run(name.c_str(), "MiB/s", 2, 20, [&]() {
+                const uint64_t start = monotonicNs();
+                VK_CHECK_RESULT(vkQueueSubmit(m_queue.queue, 1, &submitInfo, fence));
+                VK_CHECK_RESULT(vkWaitForFences(m_device, 1, &fence, VK_TRUE, UINT64_MAX));
+
+                void* mapped;
+                VK_CHECK_RESULT(vkMapMemory(m_device, staging.memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+                VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+                mappedRange.memory = staging.memory;
+                mappedRange.size = VK_WHOLE_SIZE;
+                vkInvalidateMappedMemoryRanges(m_device, 1, &mappedRange);
+                memcpy(host.data(), mapped, size);
+                vkUnmapMemory(m_device, staging.memory);
+
+                const uint64_t elapsed = monotonicNs() - start;
+                VK_CHECK_RESULT(vkResetFences(m_device, 1, &fence));
+                return (double(size) / (1 << 20)) / (elapsed / 1e9);
+            });
+
+            vkDestroyFence(m_device, fence, nullptr);
+            vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
+            destroyBuffer(m_base, staging);
+            destroyBuffer(m_base, source);
+        }
+    }
+};
+
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        g_filter = argv[1];
+    }
+
+    // Keep stdout for the results, the tool's own logging goes to stderr
+    g_results = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    fprintf(g_results, "benchmark,unit,iterations,min,median,p90,max,mean\n");
+
+    run("base_create", "ns", 1, 10, []() {
+        const uint64_t start = monotonicNs();
+        Base base({ kPriority }, {});
+        return double(monotonicNs() - start);
+    });
+
+    Base base({ kPriority }, {});
+    {
+        Bench bench(base);
+        bench.workloads();
+        bench.pipelines();
+        bench.recording();
+        bench.submission();
+        bench.readback();
+    }
+
+    fclose(g_results);
+    return 0;
+}
@@ -24,10 +24,14 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <mutex>
+#include <string>
 
 #include <vulkan/vulkan.h>
 #include "VulkanTools.h"
 #include "base.hpp"
+#include "threadpool.hpp"
+#include "verify.hpp"
 
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
 android_app* androidapp;
@@ -36,12 +40,42 @@ android_app* androidapp;
 #define DEBUG (!NDEBUG)
 
 #define BUFFER_ELEMENTS 32
+#define WORKGROUP_SIZE 64     // local_size_x of headless.comp
+
+/*
+	Options of a ComputeWork. With zeroCopy the storage buffer is placed in memory the host
+	can map, and results are read in place instead of being copied to a staging buffer at the
+	end of every submission. Without such memory the copy is kept. elements sets the size of
+	the storage buffer; only small buffers are printed, every buffer is verified. frames is
+	the number of submissions that can be in flight, each with a command buffer of its own.
+	progressInterval writes a progress timestamp after every that many dispatches, 0 none.
+	statistics collects pipeline statistics of every submission when the device supports them.
+	recordOnly builds the pipeline and buffers for a workload that records the dispatches into
+	command buffers of its own; there are no command buffers or query pools then, and the
+	ComputeWork itself cannot be submitted.
+*/
+struct ComputeConfig {
+	bool zeroCopy = false;
+	uint32_t elements = BUFFER_ELEMENTS;
+	uint32_t frames = 1;
+	uint32_t progressInterval = 0;
+	bool statistics = false;
+	bool recordOnly = false;
+};
 
 class ComputeWork : public Workload
 {
-    const VkDeviceSize bufferSize = BUFFER_ELEMENTS * sizeof(uint32_t);
+    const uint32_t elements;
+    const VkDeviceSize bufferSize;
     std::vector<uint32_t> computeInput;
-    std::vector<uint32_t> computeOutput;
+    unsigned dispatchCount;             // dispatches recorded in the command buffer
+    unsigned submissions = 0;           // each one adds dispatchCount to every element
+
+    enum class ResultPath {
+        Copy,                   // device local storage, copied to hostBuffer by every submission
+        DeviceLocalHostVisible, // resizable BAR, UMA and software devices
+        ImportedHost            // host allocation imported with VK_EXT_external_memory_host
+    };
 
 public:
 	VkInstance instance;
@@ -50,19 +84,26 @@ public:
 	uint32_t queueFamilyIndex;
 	VkPipelineCache pipelineCache;
 	VkQueue queue;
+	std::mutex* queueMutex;
+	MemoryTracker* memoryTracker;
+	unsigned memoryOwner;
 	VkCommandPool commandPool;
-	VkCommandBuffer commandBuffer;
-	VkFence fence;
+	FrameRing frames;
+	ProgressMarks progress;
 	VkDescriptorPool descriptorPool;
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSet descriptorSet;
 	VkPipelineLayout pipelineLayout;
 	VkPipeline pipeline;
 	VkShaderModule shaderModule;
-	VkQueryPool query_pool;
 
-    VkBuffer deviceBuffer, hostBuffer;
-    VkDeviceMemory deviceMemory, hostMemory;
+    VkBuffer deviceBuffer, hostBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory deviceMemory, hostMemory = VK_NULL_HANDLE;
+    ResultPath resultPath = ResultPath::Copy;
+    bool zeroCopy;
+    bool externalMemoryHost;
+    void* resultMapped = nullptr;       // persistent mapping of deviceMemory without the copy
+    void* hostAllocation = nullptr;
 
 	VkDebugReportCallbackEXT debugReportCallback{};
 
@@ -92,7 +133,7 @@ public:
 			memReqs.memoryTypeBits >>= 1;
 		}
 		assert(memTypeFound);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, memory));
+		VK_CHECK_RESULT(memoryTracker->allocate(device, memAlloc, memory, memoryOwner));
 
 		if (data != nullptr) {
 			void *mapped;
@@ -106,315 +147,603 @@ public:
 		return VK_SUCCESS;
 	}
 
-	ComputeWork(Base& base, QueueInfo queueInfo, unsigned commandCount = 1)
-        : computeInput(BUFFER_ELEMENTS)
-        , computeOutput(BUFFER_ELEMENTS)
+	bool findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t* index)
 	{
-        device = base.GetDevice();
-        instance = base.GetInstance();
-        physicalDevice = base.GetPhysicalDevice();
-        queueFamilyIndex = queueInfo.familyIndex;
-        queue = queueInfo.queue;
+		VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
+		for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++) {
+			if ((typeBits & (1u << i)) && (deviceMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				*index = i;
+				return true;
+			}
+		}
+		return false;
+	}
 
-		// Compute command pool
-		VkCommandPoolCreateInfo cmdPoolInfo = {};
-		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
-		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
+	// Maps the storage buffer for good and writes the input through the mapping
+	void mapStorage()
+	{
+		VK_CHECK_RESULT(vkMapMemory(device, deviceMemory, 0, VK_WHOLE_SIZE, 0, &resultMapped));
+		memcpy(resultMapped, computeInput.data(), bufferSize);
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = deviceMemory;
+		mappedRange.offset = 0;
+		mappedRange.size = VK_WHOLE_SIZE;
+		vkFlushMappedMemoryRanges(device, 1, &mappedRange);
+	}
 
-		VkQueryPoolCreateInfo query_pool_info;
-		query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
-		query_pool_info.pNext = NULL;
-		query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
-		query_pool_info.flags = 0;
-		query_pool_info.queryCount = 2;
-		query_pool_info.pipelineStatistics = 0;
-		VK_CHECK_RESULT(vkCreateQueryPool(device, &query_pool_info, NULL, &query_pool));
+	/*
+		Storage buffer in device local, host visible memory
+	*/
+	bool createHostVisibleStorage()
+	{
+		VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bufferSize);
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &deviceBuffer));
 
-		/*
-			Prepare storage buffers
-		*/
+		VkMemoryRequirements memReqs;
+		vkGetBufferMemoryRequirements(device, deviceBuffer, &memReqs);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		// The heap may be small (256 MiB BAR), so a failed allocation falls back as well
+		if (!findMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &memAlloc.memoryTypeIndex)
+			|| memoryTracker->allocate(device, memAlloc, &deviceMemory, memoryOwner) != VK_SUCCESS) {
+			vkDestroyBuffer(device, deviceBuffer, nullptr);
+			return false;
+		}
+		VK_CHECK_RESULT(vkBindBufferMemory(device, deviceBuffer, deviceMemory, 0));
+		mapStorage();
+		resultPath = ResultPath::DeviceLocalHostVisible;
+		return true;
+	}
 
-		// Fill input data
-		uint32_t n = 0;
-		std::generate(computeInput.begin(), computeInput.end(), [&n] { return n++; });
+	/*
+		Storage buffer on imported host memory
+	*/
+	bool importHostStorage()
+	{
+		if (!externalMemoryHost) {
+			return false;
+		}
+		VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+		hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+		VkPhysicalDeviceProperties2 properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties.pNext = &hostProperties;
+		vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+		// Pointer and size of the import must both be aligned
+		const VkDeviceSize alignment = hostProperties.minImportedHostPointerAlignment;
+		const VkDeviceSize allocationSize = (bufferSize + alignment - 1) / alignment * alignment;
+		hostAllocation = aligned_alloc(alignment, allocationSize);
+
+		PFN_vkGetMemoryHostPointerPropertiesEXT vkGetMemoryHostPointerPropertiesEXT =
+			reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT"));
+		VkMemoryHostPointerPropertiesEXT pointerProperties = {};
+		pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+		if (hostAllocation == nullptr || vkGetMemoryHostPointerPropertiesEXT(device,
+				VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, hostAllocation, &pointerProperties) != VK_SUCCESS) {
+			free(hostAllocation);
+			hostAllocation = nullptr;
+			return false;
+		}
 
-		// Copy input data to VRAM using a staging buffer
-		{
-			createBuffer(
-				VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-				&hostBuffer,
-				&hostMemory,
-				bufferSize,
-				computeInput.data());
-
-			// Flush writes to host visible buffer
-			void* mapped;
-			vkMapMemory(device, hostMemory, 0, VK_WHOLE_SIZE, 0, &mapped);
-			VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
-			mappedRange.memory = hostMemory;
-			mappedRange.offset = 0;
-			mappedRange.size = VK_WHOLE_SIZE;
-			vkFlushMappedMemoryRanges(device, 1, &mappedRange);
-			vkUnmapMemory(device, hostMemory);
-
-			createBuffer(
-				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-				&deviceBuffer,
-				&deviceMemory,
-				bufferSize);
-
-			// Copy to staging buffer
-			VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-			VkCommandBuffer copyCmd;
-			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &copyCmd));
-			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
-			VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
-			//vkCmdResetQueryPool(copyCmd, query_pool, 0, 2);
-			VkBufferCopy copyRegion = {};
-			copyRegion.size = bufferSize;
-			//vkCmdWriteTimestamp(copyCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
-			vkCmdCopyBuffer(copyCmd, hostBuffer, deviceBuffer, 1, &copyRegion);
-			//vkCmdWriteTimestamp(copyCmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
-			VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
-
-			VkSubmitInfo submitInfo = vks::initializers::submitInfo();
-			submitInfo.commandBufferCount = 1;
-			submitInfo.pCommandBuffers = &copyCmd;
-			VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FLAGS_NONE);
-			VkFence fence;
-			VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
-
-			// Submit to the queue
-			VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-			VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+		VkExternalMemoryBufferCreateInfo externalCreateInfo = {};
+		externalCreateInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+		externalCreateInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+		VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bufferSize);
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		bufferCreateInfo.pNext = &externalCreateInfo;
+		VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &deviceBuffer));
+
+		VkMemoryRequirements memReqs;
+		vkGetBufferMemoryRequirements(device, deviceBuffer, &memReqs);
+		VkImportMemoryHostPointerInfoEXT importInfo = {};
+		importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+		importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+		importInfo.pHostPointer = hostAllocation;
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.pNext = &importInfo;
+		memAlloc.allocationSize = allocationSize;
+		if (!findMemoryType(memReqs.memoryTypeBits & pointerProperties.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &memAlloc.memoryTypeIndex)
+			|| memoryTracker->allocate(device, memAlloc, &deviceMemory, memoryOwner) != VK_SUCCESS) {
+			vkDestroyBuffer(device, deviceBuffer, nullptr);
+			free(hostAllocation);
+			hostAllocation = nullptr;
+			return false;
+		}
+		VK_CHECK_RESULT(vkBindBufferMemory(device, deviceBuffer, deviceMemory, 0));
+		mapStorage();
+		resultPath = ResultPath::ImportedHost;
+		return true;
+	}
 
-			vkDestroyFence(device, fence, nullptr);
-			vkFreeCommandBuffers(device, commandPool, 1, &copyCmd);
+	/*
+		Prepare storage buffers
+	*/
+	void uploadInput()
+	{
+		if (zeroCopy) {
+			if (createHostVisibleStorage() || importHostStorage()) {
+				return;
+			}
+			LOG("No host visible memory for the storage buffer, results are copied back\n");
 		}
 
-		/*
-			Prepare compute pipeline
-		*/
+		createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+			&hostBuffer,
+			&hostMemory,
+			bufferSize,
+			computeInput.data());
+
+		// Flush writes to host visible buffer
+		void* mapped;
+		vkMapMemory(device, hostMemory, 0, VK_WHOLE_SIZE, 0, &mapped);
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = hostMemory;
+		mappedRange.offset = 0;
+		mappedRange.size = VK_WHOLE_SIZE;
+		vkFlushMappedMemoryRanges(device, 1, &mappedRange);
+		vkUnmapMemory(device, hostMemory);
+
+		createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&deviceBuffer,
+			&deviceMemory,
+			bufferSize);
+
+		// Copy to staging buffer, from a command pool of its own so this can run beside the pipeline compile
+		VkCommandPool uploadPool;
+		VkCommandPoolCreateInfo cmdPoolInfo = {};
+		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &uploadPool));
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(uploadPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VkCommandBuffer copyCmd;
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &copyCmd));
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
+		//vkCmdResetQueryPool(copyCmd, query_pool, 0, 2);
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = bufferSize;
+		//vkCmdWriteTimestamp(copyCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+		vkCmdCopyBuffer(copyCmd, hostBuffer, deviceBuffer, 1, &copyRegion);
+		//vkCmdWriteTimestamp(copyCmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+		VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
+
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &copyCmd;
+		VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FLAGS_NONE);
+		VkFence fence;
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
+
+		// Submit to the queue
 		{
-			std::vector<VkDescriptorPoolSize> poolSizes = {
-				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1),
-			};
-
-			VkDescriptorPoolCreateInfo descriptorPoolInfo =
-				vks::initializers::descriptorPoolCreateInfo(static_cast<uint32_t>(poolSizes.size()), poolSizes.data(), 1);
-			VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
-
-			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
-			};
-			VkDescriptorSetLayoutCreateInfo descriptorLayout =
-				vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
-			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &descriptorSetLayout));
-
-			VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
-				vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
-			VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout));
-
-			VkDescriptorSetAllocateInfo allocInfo =
-				vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
-			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
-
-			VkDescriptorBufferInfo bufferDescriptor = { deviceBuffer, 0, VK_WHOLE_SIZE };
-			std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets = {
-				vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &bufferDescriptor),
-			};
-			vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
-
-			VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-			pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-			VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
-
-			// Create pipeline
-			VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout, 0);
-
-			// Pass SSBO size via specialization constant
-			struct SpecializationData {
-				uint32_t BUFFER_ELEMENT_COUNT = BUFFER_ELEMENTS;
-			} specializationData;
-			VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
-			VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(SpecializationData), &specializationData);
-
-			VkPipelineShaderStageCreateInfo shaderStage = {};
-			shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			shaderStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+			std::lock_guard<std::mutex> lock(*queueMutex);
+			VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+		}
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+
+		vkDestroyFence(device, fence, nullptr);
+		vkDestroyCommandPool(device, uploadPool, nullptr);
+	}
+
+	/*
+		Prepare compute pipeline
+	*/
+	void createPipeline()
+	{
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1),
+		};
+
+		VkDescriptorPoolCreateInfo descriptorPoolInfo =
+			vks::initializers::descriptorPoolCreateInfo(static_cast<uint32_t>(poolSizes.size()), poolSizes.data(), 1);
+		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
+
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		};
+		VkDescriptorSetLayoutCreateInfo descriptorLayout =
+			vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &descriptorSetLayout));
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+			vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout));
+
+		VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+		pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+
+		// Create pipeline
+		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout, 0);
+
+		// Pass SSBO size via specialization constant
+		struct SpecializationData {
+			uint32_t BUFFER_ELEMENT_COUNT;
+		} specializationData;
+		specializationData.BUFFER_ELEMENT_COUNT = elements;
+		VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(SpecializationData), &specializationData);
+
+		VkPipelineShaderStageCreateInfo shaderStage = {};
+		shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
 #if 1
-			const uint32_t headless_comp[] = {
-				#include "headless.comp.inc"
-			};
-			shaderStage.module = vks::tools::loadShader(sizeof(headless_comp), headless_comp, device);
+		const uint32_t headless_comp[] = {
+			#include "headless.comp.inc"
+		};
+		shaderStage.module = vks::tools::loadShader(sizeof(headless_comp), headless_comp, device);
 #else
-			shaderStage.module = vks::tools::loadShader(ASSET_PATH "shaders/computeheadless/headless.comp.spv", device);
+		shaderStage.module = vks::tools::loadShader(ASSET_PATH "shaders/computeheadless/headless.comp.spv", device);
 #endif
-			shaderStage.pName = "main";
-			shaderStage.pSpecializationInfo = &specializationInfo;
-			shaderModule = shaderStage.module;
-
-			assert(shaderStage.module != VK_NULL_HANDLE);
-			computePipelineCreateInfo.stage = shaderStage;
-			VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipeline));
-
-			// Create a command buffer for compute operations
-			VkCommandBufferAllocateInfo cmdBufAllocateInfo =
-				vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &commandBuffer));
-
-			// Fence for compute CB sync
-			VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-			VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
-		}
+		shaderStage.pName = "main";
+		shaderStage.pSpecializationInfo = &specializationInfo;
+		shaderModule = shaderStage.module;
 
-		/*
-			Command buffer creation (for compute work submission)
-		*/
-		{
-			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		assert(shaderStage.module != VK_NULL_HANDLE);
+		computePipelineCreateInfo.stage = shaderStage;
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipeline));
+	}
 
-			VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
-			vkCmdResetQueryPool(commandBuffer, query_pool, 0, 2);
-			// Barrier to ensure that input buffer transfer is finished before compute shader reads from it
-			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
-			bufferBarrier.buffer = deviceBuffer;
-			bufferBarrier.size = VK_WHOLE_SIZE;
-			bufferBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-			bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-			bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	// Needs the storage buffer and the descriptor pool and layout
+	void createDescriptorSet()
+	{
+		VkDescriptorSetAllocateInfo allocInfo =
+			vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
+
+		VkDescriptorBufferInfo bufferDescriptor = { deviceBuffer, 0, VK_WHOLE_SIZE };
+		std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets = {
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &bufferDescriptor),
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
+	}
 
-			vkCmdPipelineBarrier(
-				commandBuffer,
-				VK_PIPELINE_STAGE_HOST_BIT,
-				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-				VK_FLAGS_NONE,
-				0, nullptr,
-				1, &bufferBarrier,
-				0, nullptr);
+	/*
+		The pieces of a compute command buffer, also recorded into the command buffers of MixedWork:
+		recordSetup once first, then bindPipeline and the dispatches, recordReadback once last
+	*/
+	void recordSetup(VkCommandBuffer commandBuffer)
+	{
+		// Barrier to ensure that input buffer transfer is finished before compute shader reads from it
+		VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+		bufferBarrier.buffer = deviceBuffer;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		bufferBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_HOST_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_FLAGS_NONE,
+			0, nullptr,
+			1, &bufferBarrier,
+			0, nullptr);
+
+		// Submissions of other frames may still be running, they increment and read back the same buffer
+		VkMemoryBarrier frameBarrier = vks::initializers::memoryBarrier();
+		frameBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		frameBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_FLAGS_NONE, 1, &frameBarrier, 0, nullptr, 0, nullptr);
+	}
 
-			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
-			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
-			for (int i = 0;i < commandCount; i++) {
-			vkCmdDispatch(commandBuffer, BUFFER_ELEMENTS, 1, 1);
-			}
-			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+	void bindPipeline(VkCommandBuffer commandBuffer)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+	}
+
+	// Every dispatch increments the result of the previous one, so all but the first wait for it
+	void recordDispatch(VkCommandBuffer commandBuffer, bool first)
+	{
+		if (!first) {
+			VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+			memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		}
+		vkCmdDispatch(commandBuffer, (elements + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+	}
 
-			// Barrier to ensure that shader writes are finished before buffer is read back from GPU
+	void recordReadback(VkCommandBuffer commandBuffer)
+	{
+		VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+		if (resultPath != ResultPath::Copy) {
+			// Results are read in place, only the shader writes have to be made visible to the host
 			bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-			bufferBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
 			bufferBarrier.buffer = deviceBuffer;
 			bufferBarrier.size = VK_WHOLE_SIZE;
-			bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 
 			vkCmdPipelineBarrier(
 				commandBuffer,
 				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_HOST_BIT,
 				VK_FLAGS_NONE,
 				0, nullptr,
 				1, &bufferBarrier,
 				0, nullptr);
+			return;
+		}
 
-			// Read back to host visible buffer
-			VkBufferCopy copyRegion = {};
-			copyRegion.size = bufferSize;
-			//vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 4);
-			vkCmdCopyBuffer(commandBuffer, deviceBuffer, hostBuffer, 1, &copyRegion);
-			//vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 5);
+		// Barrier to ensure that shader writes are finished before buffer is read back from GPU
+		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		bufferBarrier.buffer = deviceBuffer;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_FLAGS_NONE,
+			0, nullptr,
+			1, &bufferBarrier,
+			0, nullptr);
+
+		// Read back to host visible buffer
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = bufferSize;
+		//vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 4);
+		vkCmdCopyBuffer(commandBuffer, deviceBuffer, hostBuffer, 1, &copyRegion);
+		//vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 5);
+
+		// Barrier to ensure that buffer copy is finished before host reading from it
+		bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		bufferBarrier.buffer = hostBuffer;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT,
+			VK_FLAGS_NONE,
+			0, nullptr,
+			1, &bufferBarrier,
+			0, nullptr);
+	}
 
-			// Barrier to ensure that buffer copy is finished before host reading from it
-			bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
-			bufferBarrier.buffer = hostBuffer;
-			bufferBarrier.size = VK_WHOLE_SIZE;
-			bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	/*
+		Command buffer creation (for compute work submission), the same commands on every frame
+	*/
+	void recordCommands(FrameRing::Frame const& frame, unsigned commandCount)
+	{
+		const VkCommandBuffer commandBuffer = frame.commandBuffer;
+		const VkQueryPool query_pool = frame.queryPool;
 
-			vkCmdPipelineBarrier(
-				commandBuffer,
-				VK_PIPELINE_STAGE_TRANSFER_BIT,
-				VK_PIPELINE_STAGE_HOST_BIT,
-				VK_FLAGS_NONE,
-				0, nullptr,
-				1, &bufferBarrier,
-				0, nullptr);
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		const VkQueryPool statisticsPool = frame.statisticsPool;
+		if (!frames.hostQueryReset()) {
+			vkCmdResetQueryPool(commandBuffer, query_pool, 0, frames.queries());
+			if (statisticsPool != VK_NULL_HANDLE) {
+				vkCmdResetQueryPool(commandBuffer, statisticsPool, 0, 1);
+			}
+		}
+		recordSetup(commandBuffer);
+		bindPipeline(commandBuffer);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+		if (statisticsPool != VK_NULL_HANDLE) {
+			vkCmdBeginQuery(commandBuffer, statisticsPool, 0, 0);
+		}
+		for (unsigned i = 0; i < commandCount; i++) {
+			recordDispatch(commandBuffer, i == 0);
+			progress.write(commandBuffer, query_pool, i);
+		}
+		if (statisticsPool != VK_NULL_HANDLE) {
+			vkCmdEndQuery(commandBuffer, statisticsPool, 0);
+		}
+		dispatchCount = commandCount;
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+
+		recordReadback(commandBuffer);
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+	}
+
+	// Whether the device can bind and dispatch over the elements of config, else why not
+	static bool supports(Base& base, ComputeConfig const& config, std::string* why)
+	{
+		const VkPhysicalDeviceLimits limits = base.GetPhysicalDeviceProperties().limits;
+		const uint64_t elements = std::max(config.elements, 1u);
+		std::string text;
+		if ((elements + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE > limits.maxComputeWorkGroupCount[0]) {
+			text = std::to_string(elements) + " elements need more than "
+				+ std::to_string(limits.maxComputeWorkGroupCount[0]) + " workgroups";
+		} else if (elements * sizeof(uint32_t) > limits.maxStorageBufferRange) {
+			text = std::to_string(elements) + " elements exceed the storage buffer range of "
+				+ std::to_string(limits.maxStorageBufferRange) + " bytes";
+		} else {
+			return true;
+		}
+		if (why) {
+			*why = text;
+		}
+		return false;
+	}
+
+	ComputeWork(Base& base, QueueInfo queueInfo, unsigned commandCount = 1,
+		ComputeConfig const& config = ComputeConfig(), ThreadPool* pool = nullptr)
+        : elements(std::max(config.elements, 1u))
+        , bufferSize(elements * sizeof(uint32_t))
+        , computeInput(elements)
+        , zeroCopy(config.zeroCopy)
+        , externalMemoryHost(base.IsDeviceExtensionEnabled(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME))
+	{
+        device = base.GetDevice();
+        instance = base.GetInstance();
+        physicalDevice = base.GetPhysicalDevice();
+        queueFamilyIndex = queueInfo.familyIndex;
+        queue = queueInfo.queue;
+        queueMutex = &base.GetQueueMutex(queue);
+        memoryTracker = &base.GetMemoryTracker();
+        memoryOwner = memoryTracker->addOwner("compute priority " + std::to_string(queueInfo.priority));
+
+		std::string why;
+		if (!supports(base, config, &why)) {
+			LOG("%s\n", why.c_str());
+			exit(-1);
+		}
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+		// Compute command pool
+		VkCommandPoolCreateInfo cmdPoolInfo = {};
+		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
+		progress.interval = config.progressInterval;
+		progress.commandCount = commandCount;
+		if (config.statistics && !base.HasPipelineStatistics()) {
+			LOG("Pipeline statistics queries are not supported, statistics are not collected\n");
+		}
+		const VkQueryPipelineStatisticFlags statistics = config.statistics && base.HasPipelineStatistics()
+			? PipelineStatistics::computeFlags() : 0;
+		if (!config.recordOnly) {
+			frames.create(device, commandPool, config.frames, progress.queries(), base.GetHostQueryReset(), statistics);
+		}
 
+		// Fill input data
+		uint32_t n = 0;
+		std::generate(computeInput.begin(), computeInput.end(), [&n] { return n++; });
+
+		// The upload and the pipeline compile are independent
+		{
+			TaskGroup tasks(pool);
+			tasks.run([this]() { uploadInput(); });
+			tasks.run([this]() { createPipeline(); });
+		}
+		createDescriptorSet();
+		for (auto& frame : frames) {
+			recordCommands(frame, commandCount);
 		}
 	}
 
-    virtual VkFence submit() override {
-        // Submit compute work
-        vkResetFences(device, 1, &fence);
-        const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
-        computeSubmitInfo.pWaitDstStageMask = &waitStageMask;
-        computeSubmitInfo.commandBufferCount = 1;
-        computeSubmitInfo.pCommandBuffers = &commandBuffer;
-        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &computeSubmitInfo, fence));
-
-        return fence;
+    virtual Submission prepareSubmit() override {
+        const unsigned frame = frames.acquire();
+        submissions++;
+
+        Submission submission = {};
+        submission.queue = queue;
+        submission.commandBuffer = frames[frame].commandBuffer;
+        submission.fence = frames[frame].fence;
+        return submission;
     }
 
-	virtual void queryTimestamp(uint64_t time_stamp[], int count) override {
-		VK_CHECK_RESULT(vkGetQueryPoolResults(device, query_pool, 0, count,
+    virtual unsigned depth() const override { return frames.depth(); }
+    virtual unsigned lastFrame() const override { return frames.last(); }
+
+	virtual void queryTimestamp(unsigned frame, uint64_t time_stamp[], int count) override {
+		VK_CHECK_RESULT(vkGetQueryPoolResults(device, frames[frame].queryPool, 0, count,
 			sizeof(uint64_t)*count, time_stamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
 	}
 
+	virtual ProgressCurve queryProgress(unsigned frame, double timestampPeriod) override {
+		return ProgressCurve::collect(device, frames[frame].queryPool, progress, timestampPeriod);
+	}
+
+	virtual PipelineStatistics queryStatistics(unsigned frame) override {
+		if (!frames.statistics()) {
+			return PipelineStatistics();
+		}
+		return PipelineStatistics::collect(device, frames[frame].statisticsPool, frames.statistics());
+	}
+
     virtual void waitIdle() override {
-        VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+        frames.wait();
+        verify(submissions * dispatchCount);
+    }
+
+    // Prints the results and checks that every element was incremented by increment; the submissions must be done
+    void verify(uint32_t increment) {
+		// Everything submitted has to finish before its results are made visible to the host.
+		// The queue is shared with the other workloads of its priority.
+		{
+			std::lock_guard<std::mutex> lock(*queueMutex);
+			vkQueueWaitIdle(queue);
+		}
 
-        // Make device writes visible to the host
-        void *mapped;
-        vkMapMemory(device, hostMemory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        // Make device writes visible to the host, results are read in place
+        const VkDeviceMemory resultMemory = resultPath == ResultPath::Copy ? hostMemory : deviceMemory;
+        void *mapped = resultMapped;
+        if (resultPath == ResultPath::Copy) {
+            vkMapMemory(device, hostMemory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        }
         VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
-        mappedRange.memory = hostMemory;
+        mappedRange.memory = resultMemory;
         mappedRange.offset = 0;
         mappedRange.size = VK_WHOLE_SIZE;
         vkInvalidateMappedMemoryRanges(device, 1, &mappedRange);
+        const uint32_t* computeOutput = static_cast<const uint32_t*>(mapped);
 
-        // Copy to output
-        memcpy(computeOutput.data(), mapped, bufferSize);
-        vkUnmapMemory(device, hostMemory);
-
-		vkQueueWaitIdle(queue);
-
-		// Output buffer contents
-		LOG("Compute input:\n");
-		for (auto v : computeInput) {
-			LOG("%d \t", v);
+		// Output buffer contents, only when they fit on a line or two
+		if (elements <= BUFFER_ELEMENTS) {
+			std::string input, output;
+			for (auto v : computeInput) {
+				input += std::to_string(v) + " \t";
+			}
+			for (size_t i = 0; i < elements; i++) {
+				output += std::to_string(computeOutput[i]) + " \t";
+			}
+			LOG("Compute input:\n%s\n", input.c_str());
+			LOG("Compute output:\n%s\n", output.c_str());
 		}
-		std::cout << std::endl;
 
-		LOG("Compute output:\n");
-		for (auto v : computeOutput) {
-			LOG("%d \t", v);
+		// Every element must have been incremented once per dispatch, preempted or not
+		const VerifyResult result = Verifier::increment(computeInput.data(), computeOutput, elements, increment);
+		if (result.mismatches) {
+			const size_t i = result.firstMismatch;
+			LOG("Compute verify: %zu of %u elements wrong, first at %zu: expected %u got %u\n",
+				result.mismatches, elements, i, computeInput[i] + increment, computeOutput[i]);
+		} else {
+			LOG("Compute verify: %u elements ok\n", elements);
 		}
-		std::cout << std::endl;
+		LOG("Compute checksum: %016llx (%s)\n", (unsigned long long)result.checksum, result.simd ? "avx2" : "scalar");
+
+        if (resultPath == ResultPath::Copy) {
+            vkUnmapMemory(device, hostMemory);
+        }
     }
 
 	~ComputeWork()
 	{
+		if (resultMapped) {
+			vkUnmapMemory(device, deviceMemory);
+		}
 		vkDestroyBuffer(device, deviceBuffer, nullptr);
-		vkFreeMemory(device, deviceMemory, nullptr);
+		memoryTracker->free(device, deviceMemory);
+		// Imported memory has to be released before the host allocation behind it
+		free(hostAllocation);
 		vkDestroyBuffer(device, hostBuffer, nullptr);
-		vkFreeMemory(device, hostMemory, nullptr);
+		memoryTracker->free(device, hostMemory);
+		memoryTracker->releaseOwner(memoryOwner);
 
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 		vkDestroyPipeline(device, pipeline, nullptr);
 		vkDestroyPipelineCache(device, pipelineCache, nullptr);
-		vkDestroyFence(device, fence, nullptr);
 		vkDestroyCommandPool(device, commandPool, nullptr);
 		vkDestroyShaderModule(device, shaderModule, nullptr);
 #if DEBUG
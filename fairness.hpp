@@ -0,0 +1,170 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+    Host-side [launch, completion] intervals of one tenant on the GPU. The
+    solo baseline is the mean interval length measured while the tenant ran
+    alone, 0 when no baseline was taken.
+*/
+struct TenantTimeline {
+    std::string label;
+    int priority = 0;
+    unsigned submissionsPerInterval = 1;
+    std::vector<std::pair<uint64_t, uint64_t>> intervals;
+    uint64_t soloNs = 0;
+};
+
+struct TenantFairness {
+    double throughput = 0.0;       // submissions/s over the common window
+    uint64_t busyNs = 0;           // union of the tenant's intervals
+    double busyShare = 0.0;        // busyNs over the summed busy time of all tenants
+    uint64_t maxStarvationNs = 0;  // longest time with work outstanding and no completion
+    double meanNs = 0.0;
+    double slowdown = 0.0;         // meanNs / soloNs, 0 without baseline
+};
+
+/*
+    Long-run fairness between tenants sharing the GPU. Jain's index is taken
+    over throughput normalised by the solo baseline when every tenant has one,
+    over raw throughput otherwise; 1.0 is perfectly fair, 1/n is one tenant
+    getting everything.
+*/
+class FairnessReport {
+    std::vector<TenantTimeline> m_tenants;
+    std::vector<TenantFairness> m_results;
+    uint64_t m_windowNs;
+    double m_jain;
+    bool m_normalised;
+
+    static uint64_t busyTime(std::vector<std::pair<uint64_t, uint64_t>> intervals) {
+        std::sort(intervals.begin(), intervals.end());
+        uint64_t busy = 0, start = 0, end = 0;
+        bool open = false;
+
+        for (auto const& interval : intervals) {
+            if (open && interval.first <= end) {
+                end = std::max(end, interval.second);
+                continue;
+            }
+            if (open) {
+                busy += end - start;
+            }
+            start = interval.first;
+            end = interval.second;
+            open = true;
+        }
+        return open ? busy + end - start : busy;
+    }
+
+    static uint64_t maxStarvation(std::vector<std::pair<uint64_t, uint64_t>> const& intervals) {
+        // Completions sort before launches at the same time
+        std::vector<std::pair<uint64_t, int>> events;
+        for (auto const& interval : intervals) {
+            events.push_back({interval.first, 1});
+            events.push_back({interval.second, -1});
+        }
+        std::sort(events.begin(), events.end());
+
+        uint64_t longest = 0, since = 0;
+        int outstanding = 0;
+        for (auto const& event : events) {
+            if (event.second > 0) {
+                if (outstanding++ == 0) {
+                    since = event.first;
+                }
+            } else {
+                longest = std::max(longest, event.first - since);
+                since = event.first;
+                outstanding--;
+            }
+        }
+        return longest;
+    }
+
+public:
+    explicit FairnessReport(std::vector<TenantTimeline> tenants)
+        : m_tenants(std::move(tenants))
+        , m_windowNs(0)
+        , m_jain(0.0)
+        , m_normalised(!m_tenants.empty())
+    {
+        uint64_t first = UINT64_MAX, last = 0, busyTotal = 0;
+        for (auto const& tenant : m_tenants) {
+            for (auto const& interval : tenant.intervals) {
+                first = std::min(first, interval.first);
+                last = std::max(last, interval.second);
+            }
+            m_normalised = m_normalised && tenant.soloNs != 0;
+        }
+        m_windowNs = last > first ? last - first : 0;
+
+        for (auto const& tenant : m_tenants) {
+            TenantFairness result;
+            uint64_t total = 0;
+            for (auto const& interval : tenant.intervals) {
+                total += interval.second - interval.first;
+            }
+            if (!tenant.intervals.empty()) {
+                result.meanNs = static_cast<double>(total) / tenant.intervals.size();
+            }
+            if (m_windowNs) {
+                result.throughput = tenant.intervals.size() * tenant.submissionsPerInterval * 1e9 / m_windowNs;
+            }
+            result.busyNs = busyTime(tenant.intervals);
+            result.maxStarvationNs = maxStarvation(tenant.intervals);
+            if (tenant.soloNs) {
+                result.slowdown = result.meanNs / tenant.soloNs;
+            }
+            busyTotal += result.busyNs;
+            m_results.push_back(result);
+        }
+
+        double sum = 0.0, squares = 0.0;
+        for (size_t i = 0; i < m_results.size(); i++) {
+            if (busyTotal) {
+                m_results[i].busyShare = static_cast<double>(m_results[i].busyNs) / busyTotal;
+            }
+            // Solo throughput is submissionsPerInterval per soloNs
+            const double x = m_normalised
+                ? m_results[i].throughput * m_tenants[i].soloNs / (1e9 * m_tenants[i].submissionsPerInterval)
+                : m_results[i].throughput;
+            sum += x;
+            squares += x * x;
+        }
+        if (squares > 0.0) {
+            m_jain = (sum * sum) / (m_results.size() * squares);
+        }
+    }
+
+    std::vector<TenantFairness> const& GetResults() const { return m_results; }
+    double GetJainIndex() const { return m_jain; }
+
+    void print() const {
+        LOG("Fairness over %.3f ms, %zu tenants\n", m_windowNs / 1e6, m_tenants.size());
+        for (size_t i = 0; i < m_tenants.size(); i++) {
+            auto const& tenant = m_tenants[i];
+            auto const& result = m_results[i];
+            LOG("  %s priority %d: %.1f submissions/s, busy share %.3f, max starvation %lu ns, mean %.0f ns",
+                tenant.label.c_str(), tenant.priority, result.throughput, result.busyShare,
+                result.maxStarvationNs, result.meanNs);
+            if (tenant.soloNs) {
+                LOG(", solo %lu ns, slowdown %.2fx\n", tenant.soloNs, result.slowdown);
+            } else {
+                LOG(", no solo baseline\n");
+            }
+        }
+        LOG("  Jain's fairness index (%s throughput): %.3f\n", m_normalised ? "solo-normalised" : "raw", m_jain);
+    }
+};
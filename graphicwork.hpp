@@ -15,7 +15,10 @@
 #include <array>
 #include <iostream>
 #include <algorithm>
-#include <ctime>
+#include <mutex>
+#include <map>
+#include <random>
+#include <string>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -25,6 +28,8 @@
 #include <vulkan/vulkan.h>
 #include "VulkanTools.h"
 #include "base.hpp"
+#include "mesh.hpp"
+#include "threadpool.hpp"
 
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
 //android_app* androidapp;
@@ -34,6 +39,85 @@
 
 #define BUFFER_ELEMENTS 32
 
+/*
+	Render target and geometry of a GraphicsWork. VK_FORMAT_UNDEFINED as depth format picks
+	the best supported one. With more than one sample the color attachment is resolved into
+	a single sampled image at the end of the render pass, and that image is read back.
+	frames is the number of submissions that can be in flight; every frame has a command
+	buffer, a query pool and attachments of its own, and the last one rendered is read back.
+	progressInterval writes a progress timestamp after every that many draws, 0 none.
+	statistics collects pipeline statistics of every submission when the device supports them.
+	recordOnly builds the pipeline, geometry and a render target per frame for a workload that
+	records the draws into command buffers of its own; there are no command buffers or query
+	pools then, and the GraphicsWork itself cannot be submitted.
+*/
+struct GraphicsConfig {
+	uint32_t width = 1024;
+	uint32_t height = 1024;
+	VkFormat colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	Mesh::Spec mesh;
+	// Loop count of the heavy fragment shader, 0 uses the plain one
+	uint32_t fragmentIterations = 0;
+	// Of the draw positions
+	uint64_t seed = 1;
+	uint32_t frames = 1;
+	uint32_t progressInterval = 0;
+	bool statistics = false;
+	bool recordOnly = false;
+
+	// rgba8, bgra8, rgb10a2, rgba16f or rgba32f
+	static bool parseColorFormat(const std::string& str, VkFormat& format) {
+		static const std::map<std::string, VkFormat> formats = {
+			{"rgba8", VK_FORMAT_R8G8B8A8_UNORM},
+			{"bgra8", VK_FORMAT_B8G8R8A8_UNORM},
+			{"rgb10a2", VK_FORMAT_A2B10G10R10_UNORM_PACK32},
+			{"rgba16f", VK_FORMAT_R16G16B16A16_SFLOAT},
+			{"rgba32f", VK_FORMAT_R32G32B32A32_SFLOAT}
+		};
+		auto it = formats.find(str);
+		if (it == formats.end()) {
+			return false;
+		}
+		format = it->second;
+		return true;
+	}
+
+	// d16, d32, d24s8 or d32s8
+	static bool parseDepthFormat(const std::string& str, VkFormat& format) {
+		static const std::map<std::string, VkFormat> formats = {
+			{"d16", VK_FORMAT_D16_UNORM},
+			{"d32", VK_FORMAT_D32_SFLOAT},
+			{"d24s8", VK_FORMAT_D24_UNORM_S8_UINT},
+			{"d32s8", VK_FORMAT_D32_SFLOAT_S8_UINT}
+		};
+		auto it = formats.find(str);
+		if (it == formats.end()) {
+			return false;
+		}
+		format = it->second;
+		return true;
+	}
+
+	// 1, 2, 4, 8 or 16
+	static bool parseSamples(const std::string& str, VkSampleCountFlagBits& samples) {
+		static const std::map<std::string, VkSampleCountFlagBits> counts = {
+			{"1", VK_SAMPLE_COUNT_1_BIT},
+			{"2", VK_SAMPLE_COUNT_2_BIT},
+			{"4", VK_SAMPLE_COUNT_4_BIT},
+			{"8", VK_SAMPLE_COUNT_8_BIT},
+			{"16", VK_SAMPLE_COUNT_16_BIT}
+		};
+		auto it = counts.find(str);
+		if (it == counts.end()) {
+			return false;
+		}
+		samples = it->second;
+		return true;
+	}
+};
+
 class GraphicsWork : public Workload
 {
 public:
@@ -43,25 +127,41 @@ public:
 	uint32_t queueFamilyIndex;
 	VkPipelineCache pipelineCache;
 	VkQueue queue;
-    VkFence fence;
+	std::mutex* queueMutex;
+	MemoryTracker* memoryTracker;
+	unsigned memoryOwner;
 	VkCommandPool commandPool;
-	VkCommandBuffer commandBuffer;
+	FrameRing frames;
+	ProgressMarks progress;
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkPipelineLayout pipelineLayout;
 	VkPipeline pipeline;
 	std::vector<VkShaderModule> shaderModules;
 	VkBuffer vertexBuffer, indexBuffer;
 	VkDeviceMemory vertexMemory, indexMemory;
-	VkQueryPool query_pool;
+	uint32_t meshTriangles, drawTriangles;
+	bool fullscreen;
+	uint32_t fragmentIterations;
+	std::mt19937 rng;
 
 	struct FrameBufferAttachment {
 		VkImage image;
 		VkDeviceMemory memory;
 		VkImageView view;
 	};
+	using Vertex = Mesh::Vertex;
+
 	int32_t width, height;
-	VkFramebuffer framebuffer;
-	FrameBufferAttachment colorAttachment, depthAttachment;
+	VkFormat colorFormat, depthFormat;
+	VkSampleCountFlagBits samples;
+	// Render target of one frame
+	struct FrameTarget {
+		VkFramebuffer framebuffer;
+		FrameBufferAttachment colorAttachment, depthAttachment;
+		// Only created with multisampling
+		FrameBufferAttachment resolveAttachment;
+	};
+	std::vector<FrameTarget> targets;	// one per frame
 	VkRenderPass renderPass;
 
 	VkDebugReportCallbackEXT debugReportCallback{};
@@ -93,7 +193,7 @@ public:
 		vkGetBufferMemoryRequirements(device, *buffer, &memReqs);
 		memAlloc.allocationSize = memReqs.size;
 		memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, memoryPropertyFlags);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, memory));
+		VK_CHECK_RESULT(memoryTracker->allocate(device, memAlloc, memory, memoryOwner));
 
 		if (data != nullptr) {
 			void *mapped;
@@ -116,495 +216,681 @@ public:
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &cmdBuffer;
 		VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo();
+		VkFence fence;
 
 		VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+		{
+			std::lock_guard<std::mutex> lock(*queueMutex);
+			VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+		}
 		VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
 		vkDestroyFence(device, fence, nullptr);
 	}
 
-	GraphicsWork(Base& base, QueueInfo queueInfo, unsigned commandCount = 10, unsigned triangleCount = 3)
+	/*
+		Upload data to a new device local buffer through a staging buffer. Uses its own
+		command pool so several uploads can be recorded on different threads.
+	*/
+	void uploadBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer* buffer, VkDeviceMemory* memory)
 	{
-        device = base.GetDevice();
-        instance = base.GetInstance();
-        physicalDevice = base.GetPhysicalDevice();
-        queueFamilyIndex = queueInfo.familyIndex;
-        queue = queueInfo.queue;
-
-		// Command pool
+		VkBuffer stagingBuffer;
+		VkDeviceMemory stagingMemory;
+
+		createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&stagingBuffer,
+			&stagingMemory,
+			size,
+			const_cast<void*>(data));
+
+		createBuffer(
+			usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			buffer,
+			memory,
+			size);
+
+		VkCommandPool uploadPool;
 		VkCommandPoolCreateInfo cmdPoolInfo = {};
 		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
-		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &uploadPool));
 
-		VkQueryPoolCreateInfo query_pool_info;
-		query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
-		query_pool_info.pNext = NULL;
-		query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
-		query_pool_info.flags = 0;
-		query_pool_info.queryCount = 2;
-		query_pool_info.pipelineStatistics = 0;
-		VK_CHECK_RESULT(vkCreateQueryPool(device, &query_pool_info, NULL, &query_pool));
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(uploadPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VkCommandBuffer copyCmd;
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &copyCmd));
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
-		/*
-			Prepare vertex and index buffers
-		*/
-		struct Vertex {
-			float position[3];
-			float color[3];
-		};
-        auto randRange = [](float a, float b) -> float {
-            assert(b > a);
-            float dist = b - a;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = size;
+		vkCmdCopyBuffer(copyCmd, stagingBuffer, *buffer, 1, &copyRegion);
+		VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
 
-            return ((float)rand() / RAND_MAX * dist) - (dist/2);
-        };
+		submitWork(copyCmd, queue);
 
-        std::srand(std::time(nullptr));
-		{
+		vkDestroyCommandPool(device, uploadPool, nullptr);
+		vkDestroyBuffer(device, stagingBuffer, nullptr);
+		memoryTracker->free(device, stagingMemory);
+	}
 
-			std::vector<Vertex> vertices = {
-				{ {  1.0f,  1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f } },
-				{ { -1.0f,  1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
-				{ {  0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } }
-			};
-			std::vector<uint32_t> indices = { 0, 1, 2 };
+	/*
+		Prepare vertex and index buffers
+	*/
+	void uploadVertices(Mesh const& mesh)
+	{
+		uploadBuffer(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &vertexBuffer, &vertexMemory);
+	}
 
-			const VkDeviceSize vertexBufferSize = vertices.size() * sizeof(Vertex);
-			const VkDeviceSize indexBufferSize = indices.size() * sizeof(uint32_t);
+	void uploadIndices(Mesh const& mesh)
+	{
+		uploadBuffer(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &indexBuffer, &indexMemory);
+	}
 
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
+	bool isMultisampled() const
+	{
+		return samples != VK_SAMPLE_COUNT_1_BIT;
+	}
 
-			// Command buffer for copy commands (reused)
-			VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-			VkCommandBuffer copyCmd;
-			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &copyCmd));
-			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+	// The single sampled color image the frame ends up in
+	VkImage outputImage(unsigned frame) const
+	{
+		FrameTarget const& target = targets[frame];
+		return isMultisampled() ? target.resolveAttachment.image : target.colorAttachment.image;
+	}
 
-			// Copy input data to VRAM using a staging buffer
-			{
-				// Vertices
-				createBuffer(
-					VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					&stagingBuffer,
-					&stagingMemory,
-					vertexBufferSize,
-					vertices.data());
-
-				createBuffer(
-					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-					&vertexBuffer,
-					&vertexMemory,
-					vertexBufferSize);
-
-				VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
-				VkBufferCopy copyRegion = {};
-				copyRegion.size = vertexBufferSize;
-				vkCmdCopyBuffer(copyCmd, stagingBuffer, vertexBuffer, 1, &copyRegion);
-				VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
-
-				submitWork(copyCmd, queue);
-
-				vkDestroyBuffer(device, stagingBuffer, nullptr);
-				vkFreeMemory(device, stagingMemory, nullptr);
-
-				// Indices
-				createBuffer(
-					VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					&stagingBuffer,
-					&stagingMemory,
-					indexBufferSize,
-					indices.data());
-
-				createBuffer(
-					VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-					&indexBuffer,
-					&indexMemory,
-					indexBufferSize);
-
-				VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
-				copyRegion.size = indexBufferSize;
-				vkCmdCopyBuffer(copyCmd, stagingBuffer, indexBuffer, 1, &copyRegion);
-				VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
-
-				submitWork(copyCmd, queue);
-
-				vkDestroyBuffer(device, stagingBuffer, nullptr);
-				vkFreeMemory(device, stagingMemory, nullptr);
-			}
+	VkImageAspectFlags depthAspect() const
+	{
+		switch (depthFormat) {
+			case VK_FORMAT_D16_UNORM_S8_UINT:
+			case VK_FORMAT_D24_UNORM_S8_UINT:
+			case VK_FORMAT_D32_SFLOAT_S8_UINT:
+				return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+			default:
+				return VK_IMAGE_ASPECT_DEPTH_BIT;
 		}
+	}
 
-		/*
-			Create framebuffer attachments
-		*/
-		width = 1024;
-		height = 1024;
-		VkFormat colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
-		VkFormat depthFormat;
-		vks::tools::getSupportedDepthFormat(physicalDevice, &depthFormat);
-		{
-			// Color attachment
-			VkImageCreateInfo image = vks::initializers::imageCreateInfo();
-			image.imageType = VK_IMAGE_TYPE_2D;
-			image.format = colorFormat;
-			image.extent.width = width;
-			image.extent.height = height;
-			image.extent.depth = 1;
-			image.mipLevels = 1;
-			image.arrayLayers = 1;
-			image.samples = VK_SAMPLE_COUNT_1_BIT;
-			image.tiling = VK_IMAGE_TILING_OPTIMAL;
-			image.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-
-			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-			VkMemoryRequirements memReqs;
-
-			VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &colorAttachment.image));
-			vkGetImageMemoryRequirements(device, colorAttachment.image, &memReqs);
-			memAlloc.allocationSize = memReqs.size;
-			memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &colorAttachment.memory));
-			VK_CHECK_RESULT(vkBindImageMemory(device, colorAttachment.image, colorAttachment.memory, 0));
-
-			VkImageViewCreateInfo colorImageView = vks::initializers::imageViewCreateInfo();
-			colorImageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			colorImageView.format = colorFormat;
-			colorImageView.subresourceRange = {};
-			colorImageView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			colorImageView.subresourceRange.baseMipLevel = 0;
-			colorImageView.subresourceRange.levelCount = 1;
-			colorImageView.subresourceRange.baseArrayLayer = 0;
-			colorImageView.subresourceRange.layerCount = 1;
-			colorImageView.image = colorAttachment.image;
-			VK_CHECK_RESULT(vkCreateImageView(device, &colorImageView, nullptr, &colorAttachment.view));
-
-			// Depth stencil attachment
-			image.format = depthFormat;
-			image.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-
-			VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &depthAttachment.image));
-			vkGetImageMemoryRequirements(device, depthAttachment.image, &memReqs);
-			memAlloc.allocationSize = memReqs.size;
-			memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &depthAttachment.memory));
-			VK_CHECK_RESULT(vkBindImageMemory(device, depthAttachment.image, depthAttachment.memory, 0));
-
-			VkImageViewCreateInfo depthStencilView = vks::initializers::imageViewCreateInfo();
-			depthStencilView.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			depthStencilView.format = depthFormat;
-			depthStencilView.flags = 0;
-			depthStencilView.subresourceRange = {};
-			depthStencilView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-			depthStencilView.subresourceRange.baseMipLevel = 0;
-			depthStencilView.subresourceRange.levelCount = 1;
-			depthStencilView.subresourceRange.baseArrayLayer = 0;
-			depthStencilView.subresourceRange.layerCount = 1;
-			depthStencilView.image = depthAttachment.image;
-			VK_CHECK_RESULT(vkCreateImageView(device, &depthStencilView, nullptr, &depthAttachment.view));
+	// The depth format of config, the best supported one for VK_FORMAT_UNDEFINED
+	static VkFormat depthFormatOf(VkPhysicalDevice physicalDevice, GraphicsConfig const& config)
+	{
+		VkFormat format = config.depthFormat;
+		if (format == VK_FORMAT_UNDEFINED) {
+			vks::tools::getSupportedDepthFormat(physicalDevice, &format);
 		}
+		return format;
+	}
 
-		/*
-			Create renderpass
-		*/
-		{
-			std::array<VkAttachmentDescription, 2> attchmentDescriptions = {};
-			// Color attachment
-			attchmentDescriptions[0].format = colorFormat;
-			attchmentDescriptions[0].samples = VK_SAMPLE_COUNT_1_BIT;
-			attchmentDescriptions[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-			attchmentDescriptions[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-			attchmentDescriptions[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-			attchmentDescriptions[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-			attchmentDescriptions[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			attchmentDescriptions[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			// Depth attachment
-			attchmentDescriptions[1].format = depthFormat;
-			attchmentDescriptions[1].samples = VK_SAMPLE_COUNT_1_BIT;
-			attchmentDescriptions[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-			attchmentDescriptions[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-			attchmentDescriptions[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-			attchmentDescriptions[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-			attchmentDescriptions[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			attchmentDescriptions[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-			VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-			VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
-
-			VkSubpassDescription subpassDescription = {};
-			subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-			subpassDescription.colorAttachmentCount = 1;
-			subpassDescription.pColorAttachments = &colorReference;
-			subpassDescription.pDepthStencilAttachment = &depthReference;
-
-			// Use subpass dependencies for layout transitions
-			std::array<VkSubpassDependency, 2> dependencies;
-
-			dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-			dependencies[0].dstSubpass = 0;
-			dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-			dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-			dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-			dependencies[1].srcSubpass = 0;
-			dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-			dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-			dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-			dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-			// Create the actual renderpass
-			VkRenderPassCreateInfo renderPassInfo = {};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-			renderPassInfo.attachmentCount = static_cast<uint32_t>(attchmentDescriptions.size());
-			renderPassInfo.pAttachments = attchmentDescriptions.data();
-			renderPassInfo.subpassCount = 1;
-			renderPassInfo.pSubpasses = &subpassDescription;
-			renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
-			renderPassInfo.pDependencies = dependencies.data();
-			VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass));
-
-			VkImageView attachments[2];
-			attachments[0] = colorAttachment.view;
-			attachments[1] = depthAttachment.view;
-
-			VkFramebufferCreateInfo framebufferCreateInfo = vks::initializers::framebufferCreateInfo();
-			framebufferCreateInfo.renderPass = renderPass;
-			framebufferCreateInfo.attachmentCount = 2;
-			framebufferCreateInfo.pAttachments = attachments;
-			framebufferCreateInfo.width = width;
-			framebufferCreateInfo.height = height;
-			framebufferCreateInfo.layers = 1;
-			VK_CHECK_RESULT(vkCreateFramebuffer(device, &framebufferCreateInfo, nullptr, &framebuffer));
+	/*
+		Checks the GraphicsWork constructor would exit on
+	*/
+	void checkTargetSupport(Base& base, GraphicsConfig const& config)
+	{
+		std::string why;
+		if (!supports(base, config, &why)) {
+			LOG("%s\n", why.c_str());
+			exit(-1);
 		}
+	}
 
-		/*
-			Prepare graphics pipeline
-		*/
-		{
-			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {};
-			VkDescriptorSetLayoutCreateInfo descriptorLayout =
-				vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
-			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &descriptorSetLayout));
-
-			VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
-				vks::initializers::pipelineLayoutCreateInfo(nullptr, 0);
-
-			// MVP via push constant block
-			VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4), 0);
-			pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-			pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
-
-			VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout));
-
-			VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-			pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-			VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
-
-			// Create pipeline
-			VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
-				vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
-
-			VkPipelineRasterizationStateCreateInfo rasterizationState =
-				vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_CLOCKWISE);
-
-			VkPipelineColorBlendAttachmentState blendAttachmentState =
-				vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
-
-			VkPipelineColorBlendStateCreateInfo colorBlendState =
-				vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachmentState);
-
-			VkPipelineDepthStencilStateCreateInfo depthStencilState =
-				vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
-
-			VkPipelineViewportStateCreateInfo viewportState =
-				vks::initializers::pipelineViewportStateCreateInfo(1, 1);
-
-			VkPipelineMultisampleStateCreateInfo multisampleState =
-				vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT);
-
-			std::vector<VkDynamicState> dynamicStateEnables = {
-				VK_DYNAMIC_STATE_VIEWPORT,
-				VK_DYNAMIC_STATE_SCISSOR
-			};
-			VkPipelineDynamicStateCreateInfo dynamicState =
-				vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables);
-
-			VkGraphicsPipelineCreateInfo pipelineCreateInfo =
-				vks::initializers::pipelineCreateInfo(pipelineLayout, renderPass);
-
-			std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
-
-			pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
-			pipelineCreateInfo.pRasterizationState = &rasterizationState;
-			pipelineCreateInfo.pColorBlendState = &colorBlendState;
-			pipelineCreateInfo.pMultisampleState = &multisampleState;
-			pipelineCreateInfo.pViewportState = &viewportState;
-			pipelineCreateInfo.pDepthStencilState = &depthStencilState;
-			pipelineCreateInfo.pDynamicState = &dynamicState;
-			pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
-			pipelineCreateInfo.pStages = shaderStages.data();
-
-			// Vertex bindings an attributes
-			// Binding description
-			std::vector<VkVertexInputBindingDescription> vertexInputBindings = {
-				vks::initializers::vertexInputBindingDescription(0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX),
-			};
-
-			// Attribute descriptions
-			std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = {
-				vks::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0),					// Position
-				vks::initializers::vertexInputAttributeDescription(0, 1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3),	// Color
-			};
-
-			VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
-			vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInputBindings.size());
-			vertexInputState.pVertexBindingDescriptions = vertexInputBindings.data();
-			vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexInputAttributes.size());
-			vertexInputState.pVertexAttributeDescriptions = vertexInputAttributes.data();
-
-			pipelineCreateInfo.pVertexInputState = &vertexInputState;
-
-			shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-			shaderStages[0].pName = "main";
-			shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-			shaderStages[1].pName = "main";
-#if 1
-			const uint32_t triangle_vert[] = {
-				#include "triangle.vert.inc"
-			};
-			const uint32_t triangle_frag[] = {
-				#include "triangle.frag.inc"
-			};
-			shaderStages[0].module = vks::tools::loadShader(sizeof(triangle_vert), triangle_vert, device);
-			shaderStages[1].module = vks::tools::loadShader(sizeof(triangle_frag), triangle_frag, device);
-#else
-			shaderStages[0].module = vks::tools::loadShader(ASSET_PATH "shaders/renderheadless/triangle.vert.spv", device);
-			shaderStages[1].module = vks::tools::loadShader(ASSET_PATH "shaders/renderheadless/triangle.frag.spv", device);
-#endif
-			shaderModules = { shaderStages[0].module, shaderStages[1].module };
-			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline));
+	void createAttachment(VkFormat format, VkSampleCountFlagBits sampleCount, VkImageUsageFlags usage, VkImageAspectFlags aspect, FrameBufferAttachment* attachment)
+	{
+		VkImageCreateInfo image = vks::initializers::imageCreateInfo();
+		image.imageType = VK_IMAGE_TYPE_2D;
+		image.format = format;
+		image.extent.width = width;
+		image.extent.height = height;
+		image.extent.depth = 1;
+		image.mipLevels = 1;
+		image.arrayLayers = 1;
+		image.samples = sampleCount;
+		image.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image.usage = usage;
+
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		VkMemoryRequirements memReqs;
+
+		VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &attachment->image));
+		vkGetImageMemoryRequirements(device, attachment->image, &memReqs);
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(memoryTracker->allocate(device, memAlloc, &attachment->memory, memoryOwner));
+		VK_CHECK_RESULT(vkBindImageMemory(device, attachment->image, attachment->memory, 0));
+
+		VkImageViewCreateInfo imageView = vks::initializers::imageViewCreateInfo();
+		imageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		imageView.format = format;
+		imageView.flags = 0;
+		imageView.subresourceRange = {};
+		imageView.subresourceRange.aspectMask = aspect;
+		imageView.subresourceRange.baseMipLevel = 0;
+		imageView.subresourceRange.levelCount = 1;
+		imageView.subresourceRange.baseArrayLayer = 0;
+		imageView.subresourceRange.layerCount = 1;
+		imageView.image = attachment->image;
+		VK_CHECK_RESULT(vkCreateImageView(device, &imageView, nullptr, &attachment->view));
+	}
+
+	/*
+		Create framebuffer attachments, for every frame
+	*/
+	void createAttachments()
+	{
+		for (auto& target : targets) {
+			createAttachments(target);
 		}
+	}
 
-		/*
-			Command buffer creation
-		*/
-		{
-			VkCommandBufferAllocateInfo cmdBufAllocateInfo =
-				vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &commandBuffer));
+	void createAttachments(FrameTarget& target)
+	{
+		FrameBufferAttachment& colorAttachment = target.colorAttachment;
+		FrameBufferAttachment& depthAttachment = target.depthAttachment;
+		FrameBufferAttachment& resolveAttachment = target.resolveAttachment;
+		if (isMultisampled()) {
+			// The multisampled image is only resolved, the resolve target is what gets copied out
+			createAttachment(colorFormat, samples, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT, &colorAttachment);
+			createAttachment(colorFormat, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT, &resolveAttachment);
+		} else {
+			createAttachment(colorFormat, samples, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT, &colorAttachment);
+		}
+		createAttachment(depthFormat, samples, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthAspect(), &depthAttachment);
+	}
 
-			VkCommandBufferBeginInfo cmdBufInfo =
-				vks::initializers::commandBufferBeginInfo();
+	/*
+		Create renderpass
+	*/
+	void createRenderPass()
+	{
+		const bool msaa = isMultisampled();
+		std::vector<VkAttachmentDescription> attchmentDescriptions(msaa ? 3 : 2);
+		// Color attachment, only kept when it is not resolved
+		attchmentDescriptions[0].format = colorFormat;
+		attchmentDescriptions[0].samples = samples;
+		attchmentDescriptions[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attchmentDescriptions[0].storeOp = msaa ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+		attchmentDescriptions[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attchmentDescriptions[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attchmentDescriptions[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attchmentDescriptions[0].finalLayout = msaa ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		// Depth attachment
+		attchmentDescriptions[1].format = depthFormat;
+		attchmentDescriptions[1].samples = samples;
+		attchmentDescriptions[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attchmentDescriptions[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attchmentDescriptions[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attchmentDescriptions[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attchmentDescriptions[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attchmentDescriptions[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		// Resolve attachment, written at the end of the subpass
+		if (msaa) {
+			attchmentDescriptions[2].format = colorFormat;
+			attchmentDescriptions[2].samples = VK_SAMPLE_COUNT_1_BIT;
+			attchmentDescriptions[2].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attchmentDescriptions[2].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			attchmentDescriptions[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attchmentDescriptions[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attchmentDescriptions[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			attchmentDescriptions[2].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		}
 
-			VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+		VkAttachmentReference resolveReference = { 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+		VkSubpassDescription subpassDescription = {};
+		subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpassDescription.colorAttachmentCount = 1;
+		subpassDescription.pColorAttachments = &colorReference;
+		subpassDescription.pResolveAttachments = msaa ? &resolveReference : nullptr;
+		subpassDescription.pDepthStencilAttachment = &depthReference;
+
+		// Use subpass dependencies for layout transitions
+		std::array<VkSubpassDependency, 2> dependencies;
+
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+		// Create the actual renderpass
+		VkRenderPassCreateInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attchmentDescriptions.size());
+		renderPassInfo.pAttachments = attchmentDescriptions.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpassDescription;
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
+		VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass));
+	}
 
-			vkCmdResetQueryPool(commandBuffer, query_pool, 0, 2);
+	// Needs the attachments and the render pass
+	void createFramebuffer(FrameTarget& target)
+	{
+		std::vector<VkImageView> attachments = { target.colorAttachment.view, target.depthAttachment.view };
+		if (isMultisampled()) {
+			attachments.push_back(target.resolveAttachment.view);
+		}
 
-			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+		VkFramebufferCreateInfo framebufferCreateInfo = vks::initializers::framebufferCreateInfo();
+		framebufferCreateInfo.renderPass = renderPass;
+		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		framebufferCreateInfo.pAttachments = attachments.data();
+		framebufferCreateInfo.width = width;
+		framebufferCreateInfo.height = height;
+		framebufferCreateInfo.layers = 1;
+		VK_CHECK_RESULT(vkCreateFramebuffer(device, &framebufferCreateInfo, nullptr, &target.framebuffer));
+	}
 
-			VkClearValue clearValues[2];
-			clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 1.0f } };
-			clearValues[1].depthStencil = { 1.0f, 0 };
+	/*
+		Prepare graphics pipeline
+	*/
+	void createPipeline()
+	{
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {};
+		VkDescriptorSetLayoutCreateInfo descriptorLayout =
+			vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &descriptorSetLayout));
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+			vks::initializers::pipelineLayoutCreateInfo(nullptr, 0);
+
+		// MVP via push constant block
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4), 0);
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout));
+
+		VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+		pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+
+		// Create pipeline
+		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
+			vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+
+		VkPipelineRasterizationStateCreateInfo rasterizationState =
+			vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_CLOCKWISE);
+
+		VkPipelineColorBlendAttachmentState blendAttachmentState =
+			vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
+
+		VkPipelineColorBlendStateCreateInfo colorBlendState =
+			vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachmentState);
+
+		VkPipelineDepthStencilStateCreateInfo depthStencilState =
+			vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
 
-			VkRenderPassBeginInfo renderPassBeginInfo = {};
-			renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassBeginInfo.renderArea.extent.width = width;
-			renderPassBeginInfo.renderArea.extent.height = height;
-			renderPassBeginInfo.clearValueCount = 2;
-			renderPassBeginInfo.pClearValues = clearValues;
-			renderPassBeginInfo.renderPass = renderPass;
-			renderPassBeginInfo.framebuffer = framebuffer;
+		VkPipelineViewportStateCreateInfo viewportState =
+			vks::initializers::pipelineViewportStateCreateInfo(1, 1);
 
-			vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		VkPipelineMultisampleStateCreateInfo multisampleState =
+			vks::initializers::pipelineMultisampleStateCreateInfo(samples);
 
-			VkViewport viewport = {};
-			viewport.height = (float)height;
-			viewport.width = (float)width;
-			viewport.minDepth = (float)0.0f;
-			viewport.maxDepth = (float)1.0f;
-			vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		std::vector<VkDynamicState> dynamicStateEnables = {
+			VK_DYNAMIC_STATE_VIEWPORT,
+			VK_DYNAMIC_STATE_SCISSOR
+		};
+		VkPipelineDynamicStateCreateInfo dynamicState =
+			vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables);
+
+		VkGraphicsPipelineCreateInfo pipelineCreateInfo =
+			vks::initializers::pipelineCreateInfo(pipelineLayout, renderPass);
+
+		std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
+
+		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+		pipelineCreateInfo.pRasterizationState = &rasterizationState;
+		pipelineCreateInfo.pColorBlendState = &colorBlendState;
+		pipelineCreateInfo.pMultisampleState = &multisampleState;
+		pipelineCreateInfo.pViewportState = &viewportState;
+		pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+		pipelineCreateInfo.pDynamicState = &dynamicState;
+		pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+		pipelineCreateInfo.pStages = shaderStages.data();
+
+		// Vertex bindings an attributes
+		// Binding description
+		std::vector<VkVertexInputBindingDescription> vertexInputBindings = {
+			vks::initializers::vertexInputBindingDescription(0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX),
+		};
+
+		// Attribute descriptions
+		std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = {
+			vks::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0),					// Position
+			vks::initializers::vertexInputAttributeDescription(0, 1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3),	// Color
+		};
+
+		VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+		vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInputBindings.size());
+		vertexInputState.pVertexBindingDescriptions = vertexInputBindings.data();
+		vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexInputAttributes.size());
+		vertexInputState.pVertexAttributeDescriptions = vertexInputAttributes.data();
+
+		pipelineCreateInfo.pVertexInputState = &vertexInputState;
+
+		shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shaderStages[0].pName = "main";
+		shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		shaderStages[1].pName = "main";
+#if 1
+		const uint32_t triangle_vert[] = {
+			#include "triangle.vert.inc"
+		};
+		const uint32_t triangle_frag[] = {
+			#include "triangle.frag.inc"
+		};
+		const uint32_t heavy_frag[] = {
+			#include "heavy.frag.inc"
+		};
+		shaderStages[0].module = vks::tools::loadShader(sizeof(triangle_vert), triangle_vert, device);
+		if (fragmentIterations) {
+			shaderStages[1].module = vks::tools::loadShader(sizeof(heavy_frag), heavy_frag, device);
+		} else {
+			shaderStages[1].module = vks::tools::loadShader(sizeof(triangle_frag), triangle_frag, device);
+		}
+#else
+		shaderStages[0].module = vks::tools::loadShader(ASSET_PATH "shaders/renderheadless/triangle.vert.spv", device);
+		shaderStages[1].module = vks::tools::loadShader(ASSET_PATH "shaders/renderheadless/triangle.frag.spv", device);
+#endif
+		shaderModules = { shaderStages[0].module, shaderStages[1].module };
+
+		// The loop count of the heavy shader is a specialization constant, so the driver sees a fixed trip count
+		const int32_t iterations = fragmentIterations;
+		VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(int32_t));
+		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(iterations), &iterations);
+		if (fragmentIterations) {
+			shaderStages[1].pSpecializationInfo = &specializationInfo;
+		}
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline));
+	}
 
-			// Update dynamic scissor state
-			VkRect2D scissor = {};
-			scissor.extent.width = width;
-			scissor.extent.height = height;
-			vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	/*
+		The pieces of a render pass, also recorded into the command buffers of MixedWork: beginRenderPass
+		into the target of a frame, then the draws, then vkCmdEndRenderPass
+	*/
+	void beginRenderPass(VkCommandBuffer commandBuffer, unsigned frame)
+	{
+		VkClearValue clearValues[2];
+		clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 1.0f } };
+		clearValues[1].depthStencil = { 1.0f, 0 };
+
+		VkRenderPassBeginInfo renderPassBeginInfo = {};
+		renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassBeginInfo.renderArea.extent.width = width;
+		renderPassBeginInfo.renderArea.extent.height = height;
+		renderPassBeginInfo.clearValueCount = 2;
+		renderPassBeginInfo.pClearValues = clearValues;
+		renderPassBeginInfo.renderPass = renderPass;
+		renderPassBeginInfo.framebuffer = targets[frame].framebuffer;
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		VkViewport viewport = {};
+		viewport.height = (float)height;
+		viewport.width = (float)width;
+		viewport.minDepth = (float)0.0f;
+		viewport.maxDepth = (float)1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+		// Update dynamic scissor state
+		VkRect2D scissor = {};
+		scissor.extent.width = width;
+		scissor.extent.height = height;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+		// Render scene
+		VkDeviceSize offsets[1] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	}
 
-			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	// Somewhere in front of the camera, from the generator of the workload
+	glm::vec3 randomPosition()
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		float x = unit(rng) * 3.0f - 1.5f; // [-1.5,  1.5]
+		float y = unit(rng)        - 0.5f; // [-0.5,  0.5]
+		float z = unit(rng) * 1.5f - 4.0f; // [-4.0, -2.5]
+		return glm::vec3(x, y, z);
+	}
 
-			// Render scene
-			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
-			vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	// Each draw renders the next drawTriangles of the mesh from firstTriangle, wrapping around at the end: a range
+	// crossing it takes a second vkCmdDrawIndexed from the start, so every draw renders the same number of triangles
+	void recordDraw(VkCommandBuffer commandBuffer, glm::vec3 const& position, uint32_t& firstTriangle)
+	{
+		// A full screen quad is drawn untransformed, so every draw shades every pixel
+		glm::mat4 mvpMatrix = fullscreen ? glm::mat4(1.0f)
+			: glm::perspective(glm::radians(60.0f), (float)width / (float)height, 0.1f, 256.0f) * glm::translate(glm::mat4(1.0f), position);
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mvpMatrix), &mvpMatrix);
+
+		const uint32_t triangles = std::min(drawTriangles, meshTriangles - firstTriangle);
+		vkCmdDrawIndexed(commandBuffer, 3 * triangles, 1, 3 * firstTriangle, 0, 0);
+		if (triangles < drawTriangles) {
+			vkCmdDrawIndexed(commandBuffer, 3 * (drawTriangles - triangles), 1, 0, 0, 0);
+		}
+		firstTriangle = (firstTriangle + drawTriangles) % meshTriangles;
+	}
 
-            std::srand(std::time(nullptr));
-			std::vector<glm::vec3> pos(commandCount);
-            for (auto& v : pos) {
-                float x = ((float)rand() / RAND_MAX * 3.0) - 1.5f; // [-1.5,  1.5]
-                float y = ((float)rand() / RAND_MAX )      - 0.5f; // [-0.5,  0.5]
-                float z = ((float)rand() / RAND_MAX * 1.5) - 4.0f; // [-4.0, -2.5]
+	/*
+		Command buffer creation, rendering into the target of the frame
+	*/
+	void recordCommands(unsigned frame, unsigned commandCount)
+	{
+		const VkCommandBuffer commandBuffer = frames[frame].commandBuffer;
+		const VkQueryPool query_pool = frames[frame].queryPool;
 
-				v = glm::vec3(x, y, z);
-            }
+		VkCommandBufferBeginInfo cmdBufInfo =
+			vks::initializers::commandBufferBeginInfo();
 
-			for (auto v : pos) {
-				glm::mat4 mvpMatrix = glm::perspective(glm::radians(60.0f), (float)width / (float)height, 0.1f, 256.0f) * glm::translate(glm::mat4(1.0f), v);
-				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mvpMatrix), &mvpMatrix);
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
 
-                vkCmdDrawIndexed(commandBuffer, 3, 1, 0, 0, 0);
+		const VkQueryPool statisticsPool = frames[frame].statisticsPool;
+		if (!frames.hostQueryReset()) {
+			vkCmdResetQueryPool(commandBuffer, query_pool, 0, frames.queries());
+			if (statisticsPool != VK_NULL_HANDLE) {
+				vkCmdResetQueryPool(commandBuffer, statisticsPool, 0, 1);
 			}
+		}
 
-			vkCmdEndRenderPass(commandBuffer);
-			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+		if (statisticsPool != VK_NULL_HANDLE) {
+			vkCmdBeginQuery(commandBuffer, statisticsPool, 0, 0);
 		}
+		beginRenderPass(commandBuffer, frame);
+
+		uint32_t firstTriangle = 0;
+		for (unsigned i = 0; i < commandCount; i++) {
+			recordDraw(commandBuffer, randomPosition(), firstTriangle);
+			progress.write(commandBuffer, query_pool, i);
+		}
+
+		vkCmdEndRenderPass(commandBuffer);
+		if (statisticsPool != VK_NULL_HANDLE) {
+			vkCmdEndQuery(commandBuffer, statisticsPool, 0);
+		}
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
 	}
 
-    virtual VkFence submit() override {
-		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
-		VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo();
+	/*
+		Whether the device can render to the target of config, else why not
+	*/
+	static bool supports(Base& base, GraphicsConfig const& config, std::string* why)
+	{
+		const VkPhysicalDevice physicalDevice = base.GetPhysicalDevice();
+		const VkPhysicalDeviceLimits limits = base.GetPhysicalDeviceProperties().limits;
+		const VkFormat depthFormat = depthFormatOf(physicalDevice, config);
+		VkFormatProperties colorProperties, depthProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, config.colorFormat, &colorProperties);
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, depthFormat, &depthProperties);
+
+		char text[256];
+		if (config.width > limits.maxFramebufferWidth || config.height > limits.maxFramebufferHeight) {
+			snprintf(text, sizeof(text), "Render target %ux%u exceeds the device limit of %ux%u", config.width, config.height,
+				limits.maxFramebufferWidth, limits.maxFramebufferHeight);
+		} else if (!(limits.framebufferColorSampleCounts & config.samples) || !(limits.framebufferDepthSampleCounts & config.samples)) {
+			snprintf(text, sizeof(text), "%d samples are not supported by the device", config.samples);
+		} else if (!(colorProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT)) {
+			snprintf(text, sizeof(text), "Color format %d is not supported as attachment", config.colorFormat);
+		} else if (!(depthProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+			snprintf(text, sizeof(text), "Depth format %d is not supported as attachment", depthFormat);
+		} else {
+			return true;
+		}
+		if (why) {
+			*why = text;
+		}
+		return false;
+	}
 
-		VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+	// Each of the commandCount draws renders triangleCount triangles of the mesh, 0 for the whole mesh
+	GraphicsWork(Base& base, QueueInfo queueInfo, unsigned commandCount = 10, unsigned triangleCount = 0,
+		GraphicsConfig const& config = GraphicsConfig(), ThreadPool* pool = nullptr)
+	{
+        device = base.GetDevice();
+        instance = base.GetInstance();
+        physicalDevice = base.GetPhysicalDevice();
+        queueFamilyIndex = queueInfo.familyIndex;
+        queue = queueInfo.queue;
+        queueMutex = &base.GetQueueMutex(queue);
+        memoryTracker = &base.GetMemoryTracker();
+        memoryOwner = memoryTracker->addOwner("gfx priority " + std::to_string(queueInfo.priority));
 
-        return fence;
+		// Command pool
+		VkCommandPoolCreateInfo cmdPoolInfo = {};
+		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
+		progress.interval = config.progressInterval;
+		progress.commandCount = commandCount;
+		if (config.statistics && !base.HasPipelineStatistics()) {
+			LOG("Pipeline statistics queries are not supported, statistics are not collected\n");
+		}
+		const VkQueryPipelineStatisticFlags statistics = config.statistics && base.HasPipelineStatistics()
+			? PipelineStatistics::graphicsFlags() : 0;
+		if (!config.recordOnly) {
+			frames.create(device, commandPool, config.frames, progress.queries(), base.GetHostQueryReset(), statistics);
+		}
+		targets.resize(std::max(config.frames, 1u));
+
+		checkTargetSupport(base, config);
+		width = config.width;
+		height = config.height;
+		colorFormat = config.colorFormat;
+		samples = config.samples;
+		depthFormat = depthFormatOf(physicalDevice, config);
+
+		// Generated once and uploaded through staging buffers, draws pick sub-ranges of the index buffer
+		const Mesh mesh = Mesh::generate(config.mesh);
+		fullscreen = config.mesh.type == Mesh::Type::Quad;
+		fragmentIterations = config.fragmentIterations;
+		rng.seed(config.seed);
+		meshTriangles = mesh.triangleCount();
+		drawTriangles = triangleCount == 0 ? meshTriangles : std::min(triangleCount, meshTriangles);
+
+		// The render pass only needs the formats and the pipeline only needs the render pass,
+		// so the pipeline compile overlaps with the uploads and the attachment allocation
+		createRenderPass();
+		{
+			TaskGroup tasks(pool);
+			tasks.run([this, &mesh]() { uploadVertices(mesh); });
+			tasks.run([this, &mesh]() { uploadIndices(mesh); });
+			tasks.run([this]() { createAttachments(); });
+			tasks.run([this]() { createPipeline(); });
+		}
+		for (unsigned frame = 0; frame < targets.size(); frame++) {
+			createFramebuffer(targets[frame]);
+			if (!config.recordOnly) {
+				recordCommands(frame, commandCount);
+			}
+		}
+	}
+
+    virtual Submission prepareSubmit() override {
+		// Frame fences are reused across submissions
+		const unsigned frame = frames.acquire();
 
+		Submission submission = {};
+		submission.queue = queue;
+		submission.commandBuffer = frames[frame].commandBuffer;
+		submission.fence = frames[frame].fence;
+		return submission;
     }
 
-	virtual void queryTimestamp(uint64_t time_stamp[], int count) override {
-		VK_CHECK_RESULT(vkGetQueryPoolResults(device, query_pool, 0, count,
+	virtual unsigned depth() const override { return frames.depth(); }
+	virtual unsigned lastFrame() const override { return frames.last(); }
+
+	virtual void queryTimestamp(unsigned frame, uint64_t time_stamp[], int count) override {
+		VK_CHECK_RESULT(vkGetQueryPoolResults(device, frames[frame].queryPool, 0, count,
 			sizeof(uint64_t)*count, time_stamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
 	}
 
+	virtual ProgressCurve queryProgress(unsigned frame, double timestampPeriod) override {
+		return ProgressCurve::collect(device, frames[frame].queryPool, progress, timestampPeriod);
+	}
+
+	virtual PipelineStatistics queryStatistics(unsigned frame) override {
+		if (!frames.statistics()) {
+			return PipelineStatistics();
+		}
+		return PipelineStatistics::collect(device, frames[frame].statisticsPool, frames.statistics());
+	}
+
     virtual void waitIdle() override {
-		VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
-		vkDestroyFence(device, fence, nullptr);
+		frames.wait();
+		saveImage(frames.last());
+    }
 
+	// Writes the image rendered on frame to headless.ppm; the submissions must be done
+	void saveImage(unsigned frame) {
         vkDeviceWaitIdle(device);
 
 		/*
 			Copy framebuffer image to host visible image
 		*/
+		// 8 bit formats are copied as they are, anything else is blitted to RGBA8 which converts on the way
+		const std::vector<VkFormat> formats8 = { VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SRGB };
+		const bool useCopy = std::find(formats8.begin(), formats8.end(), colorFormat) != formats8.end();
+		const VkFormat readbackFormat = useCopy ? colorFormat : VK_FORMAT_R8G8B8A8_UNORM;
+		if (!useCopy) {
+			VkFormatProperties srcProperties, dstProperties;
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, colorFormat, &srcProperties);
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, readbackFormat, &dstProperties);
+			if (!(srcProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT) || !(dstProperties.linearTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+				LOG("Color format %d can not be blitted for readback, framebuffer image not saved\n", colorFormat);
+				vkQueueWaitIdle(queue);
+				return;
+			}
+		}
+
 		const char* imagedata;
 		{
 			// Create the linear tiled destination image to copy to and to read the memory from
 			VkImageCreateInfo imgCreateInfo(vks::initializers::imageCreateInfo());
 			imgCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-			imgCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+			imgCreateInfo.format = readbackFormat;
 			imgCreateInfo.extent.width = width;
 			imgCreateInfo.extent.height = height;
 			imgCreateInfo.extent.depth = 1;
@@ -625,7 +911,7 @@ public:
 			memAllocInfo.allocationSize = memRequirements.size;
 			// Memory must be host visible to copy from
 			memAllocInfo.memoryTypeIndex = getMemoryTypeIndex(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device, &memAllocInfo, nullptr, &dstImageMemory));
+			VK_CHECK_RESULT(memoryTracker->allocate(device, memAllocInfo, &dstImageMemory, memoryOwner));
 			VK_CHECK_RESULT(vkBindImageMemory(device, dstImage, dstImageMemory, 0));
 
 			// Do the actual blit from the offscreen image to our host visible destination image
@@ -647,23 +933,41 @@ public:
 				VK_PIPELINE_STAGE_TRANSFER_BIT,
 				VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
 
-			// colorAttachment.image is already in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, and does not need to be transitioned
-
-			VkImageCopy imageCopyRegion{};
-			imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageCopyRegion.srcSubresource.layerCount = 1;
-			imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageCopyRegion.dstSubresource.layerCount = 1;
-			imageCopyRegion.extent.width = width;
-			imageCopyRegion.extent.height = height;
-			imageCopyRegion.extent.depth = 1;
-
-			vkCmdCopyImage(
-				copyCmd,
-				colorAttachment.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1,
-				&imageCopyRegion);
+			// The output image (resolve target with multisampling) is already in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, and does not need to be transitioned
+
+			if (useCopy) {
+				VkImageCopy imageCopyRegion{};
+				imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				imageCopyRegion.srcSubresource.layerCount = 1;
+				imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				imageCopyRegion.dstSubresource.layerCount = 1;
+				imageCopyRegion.extent.width = width;
+				imageCopyRegion.extent.height = height;
+				imageCopyRegion.extent.depth = 1;
+
+				vkCmdCopyImage(
+					copyCmd,
+					outputImage(frame), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					1,
+					&imageCopyRegion);
+			} else {
+				VkImageBlit imageBlitRegion{};
+				imageBlitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				imageBlitRegion.srcSubresource.layerCount = 1;
+				imageBlitRegion.srcOffsets[1] = { width, height, 1 };
+				imageBlitRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				imageBlitRegion.dstSubresource.layerCount = 1;
+				imageBlitRegion.dstOffsets[1] = { width, height, 1 };
+
+				vkCmdBlitImage(
+					copyCmd,
+					outputImage(frame), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					1,
+					&imageBlitRegion,
+					VK_FILTER_NEAREST);
+			}
 
 			// Transition destination image to general layout, which is the required layout for mapping the image memory later on
 			vks::tools::insertImageMemoryBarrier(
@@ -709,7 +1013,7 @@ public:
 			// If source is BGR (destination is always RGB) and we can't use blit (which does automatic conversion), we'll have to manually swizzle color components
 			// Check if source is BGR and needs swizzle
 			std::vector<VkFormat> formatsBGR = { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SNORM };
-			const bool colorSwizzle = (std::find(formatsBGR.begin(), formatsBGR.end(), VK_FORMAT_R8G8B8A8_UNORM) != formatsBGR.end());
+			const bool colorSwizzle = (std::find(formatsBGR.begin(), formatsBGR.end(), readbackFormat) != formatsBGR.end());
 
 			// ppm binary pixel data
 			for (int32_t y = 0; y < height; y++) {
@@ -733,7 +1037,7 @@ public:
 
 			// Clean up resources
 			vkUnmapMemory(device, dstImageMemory);
-			vkFreeMemory(device, dstImageMemory, nullptr);
+			memoryTracker->free(device, dstImageMemory);
 			vkDestroyImage(device, dstImage, nullptr);
 		}
 
@@ -743,17 +1047,25 @@ public:
 	~GraphicsWork()
 	{
 		vkDestroyBuffer(device, vertexBuffer, nullptr);
-		vkFreeMemory(device, vertexMemory, nullptr);
+		memoryTracker->free(device, vertexMemory);
 		vkDestroyBuffer(device, indexBuffer, nullptr);
-		vkFreeMemory(device, indexMemory, nullptr);
-		vkDestroyImageView(device, colorAttachment.view, nullptr);
-		vkDestroyImage(device, colorAttachment.image, nullptr);
-		vkFreeMemory(device, colorAttachment.memory, nullptr);
-		vkDestroyImageView(device, depthAttachment.view, nullptr);
-		vkDestroyImage(device, depthAttachment.image, nullptr);
-		vkFreeMemory(device, depthAttachment.memory, nullptr);
+		memoryTracker->free(device, indexMemory);
+		for (auto& target : targets) {
+			vkDestroyImageView(device, target.colorAttachment.view, nullptr);
+			vkDestroyImage(device, target.colorAttachment.image, nullptr);
+			memoryTracker->free(device, target.colorAttachment.memory);
+			vkDestroyImageView(device, target.depthAttachment.view, nullptr);
+			vkDestroyImage(device, target.depthAttachment.image, nullptr);
+			memoryTracker->free(device, target.depthAttachment.memory);
+			if (isMultisampled()) {
+				vkDestroyImageView(device, target.resolveAttachment.view, nullptr);
+				vkDestroyImage(device, target.resolveAttachment.image, nullptr);
+				memoryTracker->free(device, target.resolveAttachment.memory);
+			}
+			vkDestroyFramebuffer(device, target.framebuffer, nullptr);
+		}
+		memoryTracker->releaseOwner(memoryOwner);
 		vkDestroyRenderPass(device, renderPass, nullptr);
-		vkDestroyFramebuffer(device, framebuffer, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 		vkDestroyPipeline(device, pipeline, nullptr);
@@ -0,0 +1,17 @@
+#version 450
+
+layout (location = 0) in vec3 inColor;
+
+layout (location = 0) out vec4 outFragColor;
+
+// ALU iterations per fragment, specialized per workload
+layout (constant_id = 0) const int ITERATIONS = 1024;
+
+void main()
+{
+  vec3 color = inColor;
+  for (int i = 0; i < ITERATIONS; i++) {
+    color = fract(color * 1.618034 + vec3(0.1));
+  }
+  outFragColor = vec4(color, 1.0);
+}
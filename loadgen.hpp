@@ -0,0 +1,158 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+#include "scheduler.hpp"
+#include "submitter.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+/*
+    Open-loop load: submissions arrive at a target rate (fixed interval or
+    Poisson) regardless of completions. At most `inflight` submissions are
+    outstanding; an arrival that finds them all busy queues in the generator,
+    and that wait is part of its latency. Submission i reuses workload slot
+    i % inflight, which is free once submission i - inflight has completed
+    since a queue retires its work in order.
+*/
+class LoadGenerator {
+public:
+    enum class Arrival {
+        Fixed,
+        Poisson
+    };
+
+    struct Sample {
+        uint64_t arrival;
+        uint64_t submit;
+        uint64_t complete;
+    };
+
+private:
+    Timeline& m_timeline;
+    Arrival m_arrival;
+    double m_rate;
+    unsigned m_count;
+    uint64_t m_seed;
+    std::vector<Workload*> m_slots;
+    std::vector<VkFence> m_fences;
+    std::vector<Sample> m_samples;
+    std::atomic<unsigned> m_submitted;
+    std::atomic<unsigned> m_completed;
+
+    std::vector<uint64_t> arrivals(uint64_t startNs) const {
+        std::vector<uint64_t> times(m_count);
+        std::mt19937_64 rng(m_seed);
+        std::exponential_distribution<double> gap(m_rate);
+        double t = 0.0;
+
+        for (unsigned i = 0; i < m_count; i++) {
+            times[i] = startNs + static_cast<uint64_t>(t * 1e9);
+            t += m_arrival == Arrival::Poisson ? gap(rng) : 1.0 / m_rate;
+        }
+        return times;
+    }
+
+    void reap() {
+        for (unsigned i = 0; i < m_count; i++) {
+            m_timeline.waitFor([this, i]() { return m_submitted.load(std::memory_order_acquire) > i; });
+            m_timeline.waitForFences({ m_fences[i % m_slots.size()] });
+            m_samples[i].complete = m_timeline.now();
+            m_completed.store(i + 1, std::memory_order_release);
+            m_timeline.notify();
+        }
+    }
+
+public:
+    LoadGenerator(Timeline& timeline, std::function<Workload*()> factory, Arrival arrival, double rate,
+        unsigned inflight, unsigned count, uint64_t seed)
+        : m_timeline(timeline)
+        , m_arrival(arrival)
+        , m_rate(rate)
+        , m_count(count)
+        , m_seed(seed)
+        , m_fences(std::max(inflight, 1u))
+        , m_samples(count)
+        , m_submitted(0)
+        , m_completed(0)
+    {
+        for (unsigned i = 0; i < std::max(inflight, 1u); i++) {
+            m_slots.push_back(factory());
+        }
+    }
+
+    ~LoadGenerator() {
+        for (auto workload : m_slots) {
+            delete workload;
+        }
+    }
+
+    // Submits directly, or through submitter when given. Returns once every submission completed.
+    void run(uint64_t startNs, LaunchScheduler& scheduler, Submitter* submitter = nullptr) {
+        const std::vector<uint64_t> times = arrivals(startNs);
+        const unsigned depth = m_slots.size();
+        std::thread reaper = m_timeline.spawn([this]() { reap(); });
+
+        for (unsigned i = 0; i < m_count; i++) {
+            m_samples[i].arrival = times[i];
+            scheduler.waitUntil(times[i]);
+
+            // Bounded in-flight depth: wait for the submission that last used this slot
+            if (i >= depth) {
+                m_timeline.waitFor([this, i, depth]() { return m_completed.load(std::memory_order_acquire) > i - depth; });
+            }
+
+            Workload* workload = m_slots[i % depth];
+            m_samples[i].submit = m_timeline.now();
+            if (submitter) {
+                m_fences[i % depth] = submitter->push(workload->prepareSubmit());
+            } else {
+                m_fences[i % depth] = workload->submit();
+            }
+            m_submitted.store(i + 1, std::memory_order_release);
+            m_timeline.notify();
+        }
+
+        m_timeline.join(reaper);
+        if (submitter) {
+            submitter->drain();
+        }
+    }
+
+    std::vector<Sample> const& GetSamples() const { return m_samples; }
+
+    void report(const char* label) const {
+        if (m_samples.empty()) {
+            return;
+        }
+        std::vector<uint64_t> latency, queueing;
+        for (auto const& sample : m_samples) {
+            latency.push_back(sample.complete - sample.arrival);
+            queueing.push_back(sample.submit - sample.arrival);
+        }
+        std::sort(latency.begin(), latency.end());
+        std::sort(queueing.begin(), queueing.end());
+
+        auto percentile = [](std::vector<uint64_t> const& sorted, unsigned p) {
+            return sorted[std::min<size_t>(sorted.size() - 1, (sorted.size() * p) / 100)];
+        };
+        const double span = (m_samples.back().complete - m_samples.front().arrival) / 1e9;
+
+        LOG("Open loop %s: %s arrivals, offered %.1f/s, achieved %.1f/s, inflight %zu\n", label,
+            m_arrival == Arrival::Poisson ? "poisson" : "fixed", m_rate, m_samples.size() / span, m_slots.size());
+        LOG("Open loop %s: latency ns p50 %lu p90 %lu p99 %lu max %lu\n", label,
+            percentile(latency, 50), percentile(latency, 90), percentile(latency, 99), latency.back());
+        LOG("Open loop %s: queueing ns p50 %lu p90 %lu p99 %lu max %lu\n", label,
+            percentile(queueing, 50), percentile(queueing, 90), percentile(queueing, 99), queueing.back());
+    }
+};
@@ -0,0 +1,236 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+// Messages above this level are compiled out, e.g. -DLOG_LEVEL=LOG_LEVEL_WARN
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+/*
+    Asynchronous logger. Every thread formats into a ring of its own, with no
+    locks or syscalls once the ring exists but to wake the writer when the
+    ring was empty; the writer, a background thread parked while there is
+    nothing to write, merges the rings and writes them to stdout or a file.
+    A full ring drops a debug message rather than block the hot path, and the
+    count of dropped messages is written instead; any other message drains
+    the rings on the calling thread first. Records are numbered before they
+    are formatted and written strictly in that order, a record waiting for
+    every lower numbered one to be published, so the merged output keeps the
+    order of the LOG calls. flush() writes out everything logged so far, the
+    destructor does at exit.
+*/
+class Logger {
+    static const size_t RECORD_SIZE = 512;
+    static const size_t RING_RECORDS = 256;
+
+    struct Record {
+        uint64_t sequence;
+        char text[RECORD_SIZE];
+    };
+
+    // Single producer (the owning thread), single consumer (the writer)
+    struct Ring {
+        Record records[RING_RECORDS];
+        std::atomic<uint64_t> head{0};      // next record to write out
+        std::atomic<uint64_t> tail{0};      // next record to fill
+        std::atomic<uint64_t> dropped{0};
+    };
+
+    std::mutex m_mutex;                     // guards m_rings, m_file and m_written
+    std::vector<std::shared_ptr<Ring>> m_rings;
+    FILE* m_file;
+    std::atomic<uint64_t> m_sequence;
+    uint64_t m_written = 0;                 // sequence of the next record to write out
+    std::mutex m_wakeMutex;                 // guards m_wakeups
+    std::condition_variable m_wake;
+    uint64_t m_wakeups = 0;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+
+    Ring& ring() {
+        static thread_local Ring* ring = nullptr;
+        if (ring == nullptr) {
+            std::shared_ptr<Ring> created(new Ring);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_rings.push_back(created);
+            ring = created.get();
+        }
+        return *ring;
+    }
+
+    // Writes out the queued records in sequence order, oldest first across all rings, up to the first one
+    // still being formatted, or past it with all. Returns true if records are left behind such a gap.
+    bool drain(bool all = false) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool wrote = false, behind = false;
+
+        while (true) {
+            Ring* next = nullptr;
+            for (auto const& ring : m_rings) {
+                const uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+                if (dropped) {
+                    fprintf(m_file, "[log] %lu message(s) dropped, ring full\n", (unsigned long)dropped);
+                    wrote = true;
+                }
+                // Sequentially consistent with the store in write(), so either this sees its record or
+                // write() sees the ring empty and wakes the writer
+                const uint64_t head = ring->head.load(std::memory_order_relaxed);
+                if (head != ring->tail.load()
+                    && (next == nullptr || ring->records[head % RING_RECORDS].sequence
+                        < next->records[next->head.load(std::memory_order_relaxed) % RING_RECORDS].sequence)) {
+                    next = ring.get();
+                }
+            }
+            if (next == nullptr) {
+                break;
+            }
+            const uint64_t head = next->head.load(std::memory_order_relaxed);
+            const uint64_t sequence = next->records[head % RING_RECORDS].sequence;
+            if (sequence != m_written && !all) {
+                behind = true;
+                break;
+            }
+            fputs(next->records[head % RING_RECORDS].text, m_file);
+            m_written = sequence + 1;
+            next->head.store(head + 1);
+            wrote = true;
+        }
+        if (wrote) {
+            fflush(m_file);
+        }
+        return behind;
+    }
+
+    void run() {
+        uint64_t seen = 0;
+        while (m_running.load()) {
+            const bool behind = drain();
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            if (behind) {
+                // The record in the gap goes to a ring that is not empty, so it wakes no one
+                m_wake.wait_for(lock, std::chrono::microseconds(100));
+            } else {
+                m_wake.wait(lock, [&]() { return m_wakeups != seen || !m_running.load(); });
+            }
+            seen = m_wakeups;
+        }
+        drain(true);
+    }
+
+    Logger()
+        : m_file(stdout)
+        , m_sequence(0)
+        , m_running(true)
+    {
+        m_thread = std::thread(&Logger::run, this);
+    }
+
+public:
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_running.store(false);
+        }
+        m_wake.notify_one();
+        m_thread.join();
+        if (m_file != stdout) {
+            fclose(m_file);
+        }
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    // Sends everything from now on to path instead of stdout; false if it cannot be opened
+    bool open(const char* path) {
+        FILE* file = fopen(path, "w");
+        if (file == nullptr) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file != stdout) {
+            fclose(m_file);
+        }
+        m_file = file;
+        return true;
+    }
+
+    // Waits until everything logged so far is written
+    void flush() {
+        const uint64_t logged = m_sequence.load();
+        while (true) {
+            drain();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_written >= logged) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    __attribute__((format(printf, 3, 4)))
+    void write(int level, const char* format, ...) {
+        Ring& r = ring();
+        const uint64_t tail = r.tail.load(std::memory_order_relaxed);
+        if (tail - r.head.load(std::memory_order_acquire) == RING_RECORDS) {
+            if (level >= LOG_LEVEL_DEBUG) {
+                r.dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            // Records of other threads still being formatted may hold this ring's back
+            while (tail - r.head.load(std::memory_order_acquire) == RING_RECORDS) {
+                if (drain()) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        Record& record = r.records[tail % RING_RECORDS];
+        record.sequence = m_sequence.fetch_add(1, std::memory_order_relaxed);
+        va_list args;
+        va_start(args, format);
+        vsnprintf(record.text, RECORD_SIZE, format, args);
+        va_end(args);
+        r.tail.store(tail + 1);
+        if (r.head.load() == tail) {
+            // The ring was empty, the writer may be parked
+            {
+                std::lock_guard<std::mutex> lock(m_wakeMutex);
+                m_wakeups++;
+            }
+            m_wake.notify_one();
+        }
+    }
+};
+
+#define LOG_AT(level, ...) do { if ((level) <= LOG_LEVEL) Logger::instance().write((level), __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
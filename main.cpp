@@ -7,6 +7,19 @@
 #include "base.hpp"
 #include "computework.hpp"
 #include "graphicwork.hpp"
+#include "transferwork.hpp"
+#include "mixedwork.hpp"
+#include "submitter.hpp"
+#include "scheduler.hpp"
+#include "affinity.hpp"
+#include "loadgen.hpp"
+#include "fairness.hpp"
+#include "simdevice.hpp"
+#include "threadpool.hpp"
+#include "search.hpp"
+#include "analysis.hpp"
+#include "workloadcache.hpp"
+#include "protocol.hpp"
 
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -14,11 +27,16 @@
 #include <sys/un.h>
 
 #include <unordered_map>
+#include <map>
+#include <memory>
 
 #include <regex>
 #include <chrono>
 #include <numeric>
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 #include <thread>
 
 #include<stdio.h>
@@ -28,10 +46,32 @@
 #include<sys/types.h>
 #include<sys/msg.h>
 #include<sys/ipc.h>
+#include<sys/wait.h>
 #include<errno.h>
+#include<stdarg.h>
+#include<signal.h>
 
+// Iterations per run, pass e.g. -DRUN_TIMES=1000 for long fairness runs
+#ifndef RUN_TIMES
 #define RUN_TIMES 5
+#endif
 class Request {
+    bool m_throwErrors = false;
+
+    // An invalid spec ends the process, or throws std::runtime_error for callers that outlive it (the daemon)
+    __attribute__((format(printf, 2, 3), noreturn))
+    void fail(const char* format, ...) const {
+        char text[512];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        if (m_throwErrors) {
+            throw std::runtime_error(text);
+        }
+        LOG("%s", text);
+        exit(-1);
+    }
 
     VkQueueGlobalPriorityEXT str2priority(const std::string& str) {
         static const std::unordered_map<std::string, VkQueueGlobalPriorityEXT> map = {
@@ -50,11 +90,58 @@ class Request {
         }
     }
 
+    // A whole number of at least minimum that fits T, what names it in the error
+    template <typename T>
+    T number(const char* what, const std::string& value, T minimum) const {
+        const bool negative = !value.empty() && value[0] == '-';
+        const char* digits = value.c_str() + (negative ? 1 : 0);
+        char* end = nullptr;
+        errno = 0;
+        const unsigned long long magnitude = *digits >= '0' && *digits <= '9' ? strtoull(digits, &end, 10) : 0;
+        bool valid = end != nullptr && *end == '\0' && errno != ERANGE;
+        if (valid && negative) {
+            valid = std::numeric_limits<T>::is_signed && minimum < 0
+                && magnitude <= static_cast<unsigned long long>(-static_cast<long long>(minimum));
+        } else if (valid) {
+            valid = magnitude <= static_cast<unsigned long long>(std::numeric_limits<T>::max())
+                && (minimum <= 0 || magnitude >= static_cast<unsigned long long>(minimum));
+        }
+        if (!valid) {
+            fail("%s is not a valid %s. Use a whole number of at least %lld\n", value.c_str(), what,
+                static_cast<long long>(minimum));
+        }
+        return negative ? static_cast<T>(-static_cast<long long>(magnitude)) : static_cast<T>(magnitude);
+    }
+
+    // Optional trailing ",key:value" pairs of a request spec
+    void parseOptions(const std::string& str) {
+        static const std::set<std::string> knownOptions = {
+            "submit", "cpu", "submit_cpu", "sched", "rtprio", "nice", "mlock",
+            "load", "rate", "inflight", "submissions", "seed", "solo", "build_threads",
+            "width", "height", "format", "depth_format", "samples",
+            "mesh", "triangles", "vertices", "draw_triangles", "frag_iterations",
+            "zero_copy", "elements", "log", "search", "search_trials", "search_required", "search_max",
+            "cache", "frames", "progress", "stats", "clients", "copy", "size", "regions",
+            "pass_draws", "pass_dispatches", "barrier"
+        };
+        static const std::regex regex_option(",([a-z_]+):([^,]+)");
+
+        for (std::sregex_iterator it(str.begin(), str.end(), regex_option), end; it != end; ++it) {
+            const std::string key = (*it)[1];
+            if (knownOptions.find(key) == knownOptions.end()) {
+                fail("%s is not a valid option\n", key.c_str());
+            }
+            m_options[key] = (*it)[2];
+        }
+    }
+
 
 public:
     enum class Type {
         Graphics,
-        Compute
+        Compute,
+        Transfer,
+        Mixed
     };
 
     unsigned m_commandCount;
@@ -62,29 +149,165 @@ public:
     std::chrono::microseconds m_delay = std::chrono::microseconds::zero();
     Type m_type;
     Workload* m_workload = nullptr;
+    std::map<std::string, std::string> m_options;
 
-    Request(char* str)
+    explicit Request(const char* str, bool throwErrors = false)
+        : m_throwErrors(throwErrors)
     {
-        const std::regex regex_graphic("gfx=draws:([0-9]+),priority:(low|medium|high),delay:([0-9]+)");
-        const std::regex regex_compute("compute=dispatch:([0-9]+),priority:(low|medium|high|realtime),delay:([0-9]+)");
+        const std::regex regex_graphic("gfx=draws:([0-9]+),priority:(low|medium|high),delay:([0-9]+)((,[a-z_]+:[^,]+)*)");
+        const std::regex regex_compute("compute=dispatch:([0-9]+),priority:(low|medium|high|realtime),delay:([0-9]+)((,[a-z_]+:[^,]+)*)");
+        const std::regex regex_mixed("mixed=rounds:([0-9]+),priority:(low|medium|high),delay:([0-9]+)((,[a-z_]+:[^,]+)*)");
+        const std::regex regex_transfer("transfer=copies:([0-9]+),priority:(low|medium|high|realtime),delay:([0-9]+)((,[a-z_]+:[^,]+)*)");
 
         std::cmatch m;
 
         if (std::regex_match(str, m, regex_graphic)) {
             m_type = Type::Graphics;
-            m_commandCount = stoi(m[1]);
+            m_commandCount = number<unsigned>("command count", m[1], 0);
             m_priority = str2priority(m[2]);
-            m_delay = std::chrono::microseconds(std::stoi(m[3]));
+            m_delay = std::chrono::microseconds(number<int64_t>("delay", m[3], 0));
+            parseOptions(m[4]);
         } else if (std::regex_match(str, m, regex_compute)) {
             m_type = Type::Compute;
-            m_commandCount = stoi(m[1]);
+            m_commandCount = number<unsigned>("command count", m[1], 0);
+            m_priority = str2priority(m[2]);
+            m_delay = std::chrono::microseconds(number<int64_t>("delay", m[3], 0));
+            parseOptions(m[4]);
+        } else if (std::regex_match(str, m, regex_mixed)) {
+            m_type = Type::Mixed;
+            m_commandCount = number<unsigned>("command count", m[1], 0);
+            m_priority = str2priority(m[2]);
+            m_delay = std::chrono::microseconds(number<int64_t>("delay", m[3], 0));
+            parseOptions(m[4]);
+        } else if (std::regex_match(str, m, regex_transfer)) {
+            m_type = Type::Transfer;
+            m_commandCount = number<unsigned>("command count", m[1], 0);
             m_priority = str2priority(m[2]);
-            m_delay = std::chrono::microseconds(std::stoi(m[3]));
+            m_delay = std::chrono::microseconds(number<int64_t>("delay", m[3], 0));
+            parseOptions(m[4]);
         } else {
-            LOG("Could not parse \'%s\'", str);
-            exit(-1);
+            fail("Could not parse \'%s\'\n", str);
+        }
+        LOG("Request : commands %d, priority %d, delay %lld\n", m_commandCount, m_priority, (long long)m_delay.count());
+    }
+
+    std::string option(const std::string& key, const std::string& fallback = "") const {
+        auto it = m_options.find(key);
+        return it == m_options.end() ? fallback : it->second;
+    }
+
+    // The whole number option key, fallback when not given; a value that is not a number, is below minimum
+    // or does not fit T is an invalid spec
+    template <typename T>
+    T numericOption(const std::string& key, T fallback, T minimum) const {
+        auto it = m_options.find(key);
+        return it == m_options.end() ? fallback : number<T>(key.c_str(), it->second, minimum);
+    }
+
+    // submit:thread hands submissions to a dedicated per-queue submission thread
+    bool useSubmitThread() const {
+        return option("submit", "direct") == "thread";
+    }
+
+    // load:fixed|poisson switches from the closed submit/wait loop to an open-loop load generator
+    // search:1 finds the smallest low priority workload the high priority one preempts,
+    // search_trials:N launches per size of which search_required:N must nest, up to search_max:N commands
+    bool isSearch() const {
+        return option("search", "0") == "1";
+    }
+
+    PreemptionSearch::Config searchConfig() const {
+        PreemptionSearch::Config config;
+        config.trials = numericOption<unsigned>("search_trials", config.trials, 1);
+        config.required = numericOption<unsigned>("search_required", config.required, 1);
+        config.maxCommands = numericOption<unsigned>("search_max", config.maxCommands, 1);
+        return config;
+    }
+
+    // Identifies the workloads the request builds, for the daemon's cache
+    std::string cacheKey() const {
+        std::string key = std::to_string(static_cast<int>(m_type)) + ":" + std::to_string(m_commandCount)
+            + ":" + std::to_string(m_priority);
+        for (auto const& option : m_options) {
+            key += "," + option.first + ":" + option.second;
+        }
+        return key;
+    }
+
+    // clients:N clients the server waits for and reports on together (default 1)
+    unsigned clients() const {
+        return numericOption<unsigned>("clients", 1, 1);
+    }
+
+    // frames:N submissions of every workload in flight per iteration, each on resources of its own
+    unsigned frames() const {
+        return numericOption<unsigned>("frames", 1, 1);
+    }
+
+    // progress:K writes a timestamp every K draws or dispatches and reports a progress curve per submission
+    unsigned progressInterval() const {
+        return numericOption<unsigned>("progress", 0, 0);
+    }
+
+    // stats:1 collects pipeline statistics of every submission, reported per command
+    bool pipelineStatistics() const {
+        return option("stats", "0") == "1";
+    }
+
+    bool isOpenLoop() const {
+        return m_options.count("load") != 0;
+    }
+
+    LoadGenerator::Arrival arrival() const {
+        const std::string load = option("load");
+        if (load == "poisson") {
+            return LoadGenerator::Arrival::Poisson;
+        } else if (load != "fixed") {
+            fail("%s is not a valid load. Use fixed or poisson\n", load.c_str());
+        }
+        return LoadGenerator::Arrival::Fixed;
+    }
+
+    // rate:HZ arrivals per second of open-loop runs (default 100)
+    double rate() const {
+        const std::string value = option("rate", "100");
+        char* end = nullptr;
+        const double rate = strtod(value.c_str(), &end);
+        if (*end != '\0' || !(rate > 0.0) || !std::isfinite(rate)) {
+            fail("%s is not a valid rate. Use a rate above 0\n", value.c_str());
         }
-        LOG("Request : commands %d, priority %d, delay %lld\n", m_commandCount, m_priority, m_delay.count());
+        return rate;
+    }
+
+    // mlock:0|1 locks all current and future memory of the process
+    bool lockMemory() const {
+        const std::string mlock = option("mlock", "0");
+        if (mlock != "0" && mlock != "1") {
+            fail("%s is not a valid mlock. Use 0 or 1\n", mlock.c_str());
+        }
+        return mlock == "1";
+    }
+
+    // cpuKey selects the thread: cpu for the record/submit/wait thread, submit_cpu for the submission thread.
+    // sched, rtprio and nice apply to both.
+    ThreadPolicy threadPolicy(const char* cpuKey) const {
+        ThreadPolicy policy;
+
+        if (m_options.count(cpuKey) && !ThreadPolicy::parseCpuList(option(cpuKey), policy.cpus)) {
+            fail("%s is not a valid cpu list for %s. Use e.g. 2, 2-3 or 1+5\n", option(cpuKey).c_str(), cpuKey);
+        }
+        if (m_options.count("sched")) {
+            if (!ThreadPolicy::parsePolicy(option("sched"), policy.policy)) {
+                fail("%s is not a valid scheduling policy. Use fifo, rr or other\n", option("sched").c_str());
+            }
+            policy.setScheduler = true;
+            policy.priority = policy.policy == SCHED_OTHER ? 0 : numericOption<int>("rtprio", 50, 1);
+        }
+        if (m_options.count("nice")) {
+            policy.setNice = true;
+            policy.nice = numericOption<int>("nice", 0, -20);
+        }
+        return policy;
     }
 
     ~Request() {
@@ -97,21 +320,165 @@ public:
         switch(m_type) {
             case Type::Graphics: return VK_QUEUE_GRAPHICS_BIT;
             case Type::Compute : return VK_QUEUE_COMPUTE_BIT;
+            case Type::Transfer: return VK_QUEUE_TRANSFER_BIT;
+            case Type::Mixed   : return VK_QUEUE_GRAPHICS_BIT;
         }
 	return VK_QUEUE_FLAG_BITS_MAX_ENUM;
     }
 
-    Workload* createWorkload(Base& base, QueueInfo queue, unsigned commandCount) {
+    // width, height, format, depth_format and samples describe the render target of gfx requests,
+    // mesh, triangles, vertices and seed the geometry and the draw positions, frag_iterations the fragment shader cost
+    GraphicsConfig graphicsConfig() const {
+        GraphicsConfig config;
+
+        config.width = numericOption<uint32_t>("width", config.width, 1);
+        config.height = numericOption<uint32_t>("height", config.height, 1);
+        if (m_options.count("format") && !GraphicsConfig::parseColorFormat(option("format"), config.colorFormat)) {
+            fail("%s is not a valid format. Use rgba8, bgra8, rgb10a2, rgba16f or rgba32f\n", option("format").c_str());
+        }
+        if (m_options.count("depth_format") && !GraphicsConfig::parseDepthFormat(option("depth_format"), config.depthFormat)) {
+            fail("%s is not a valid depth format. Use d16, d32, d24s8 or d32s8\n", option("depth_format").c_str());
+        }
+        if (m_options.count("samples") && !GraphicsConfig::parseSamples(option("samples"), config.samples)) {
+            fail("%s is not a valid sample count. Use 1, 2, 4, 8 or 16\n", option("samples").c_str());
+        }
+        if (m_options.count("mesh") && !Mesh::parseType(option("mesh"), config.mesh.type)) {
+            fail("%s is not a valid mesh. Use triangle, quad, grid, sphere or soup\n", option("mesh").c_str());
+        }
+        if (config.mesh.type != Mesh::Type::Triangle && config.mesh.type != Mesh::Type::Quad) {
+            config.mesh.triangles = numericOption<uint32_t>("triangles", 1024, 1);
+            config.mesh.vertices = numericOption<uint32_t>("vertices", 0, 0);
+            config.mesh.seed = numericOption<uint64_t>("seed", 1, 0);
+        }
+        config.fragmentIterations = numericOption<uint32_t>("frag_iterations", 0, 0);
+        // The heavy shader is meant to shade every pixel, which takes the full screen quad
+        if (config.fragmentIterations > 0 && !m_options.count("mesh")) {
+            config.mesh.type = Mesh::Type::Quad;
+        }
+        config.seed = numericOption<uint64_t>("seed", 1, 0);
+        config.frames = frames();
+        config.progressInterval = progressInterval();
+        config.statistics = pipelineStatistics();
+        return config;
+    }
+
+    // zero_copy:1 keeps compute results in host visible memory and reads them in place, elements:N sizes the buffer
+    ComputeConfig computeConfig() const {
+        ComputeConfig config;
+        config.zeroCopy = option("zero_copy", "0") == "1";
+        config.elements = numericOption<uint32_t>("elements", BUFFER_ELEMENTS, 1);
+        config.frames = frames();
+        config.progressInterval = progressInterval();
+        config.statistics = pipelineStatistics();
+        return config;
+    }
+
+    // copy:buffer|image picks the destination of transfer requests, size:N the bytes per copy command
+    // and regions:N the regions they are split into
+    TransferConfig transferConfig() const {
+        TransferConfig config;
+        if (m_options.count("copy") && !TransferConfig::parseKind(option("copy"), config.kind)) {
+            fail("%s is not a valid copy. Use buffer or image\n", option("copy").c_str());
+        }
+        config.size = numericOption<uint64_t>("size", config.size, 1);
+        config.regions = numericOption<uint32_t>("regions", 1, 1);
+        config.frames = frames();
+        config.progressInterval = progressInterval();
+        if (pipelineStatistics()) {
+            LOG("Transfer queues have no pipeline statistics, stats:1 is ignored\n");
+        }
+        return config;
+    }
+
+    // pass_draws:N and pass_dispatches:N per round of mixed requests (default 1 each), barrier:none|stage|full
+    // between them; the gfx and compute options apply to their parts
+    MixedConfig mixedConfig() const {
+        MixedConfig config;
+        config.graphics = graphicsConfig();
+        config.compute = computeConfig();
+        config.drawsPerPass = numericOption<unsigned>("pass_draws", 1, 1);
+        config.dispatchesPerPass = numericOption<unsigned>("pass_dispatches", 1, 1);
+        if (m_options.count("barrier") && !MixedConfig::parseBarrier(option("barrier"), config.barrier)) {
+            fail("%s is not a valid barrier. Use none, stage or full\n", option("barrier").c_str());
+        }
+        return config;
+    }
+
+    // Draws, dispatches or copies per submission; a mixed round counts its draws and dispatches
+    unsigned commands() const {
+        if (m_type == Type::Mixed) {
+            return m_commandCount * (numericOption<unsigned>("pass_draws", 1, 1)
+                + numericOption<unsigned>("pass_dispatches", 1, 1));
+        }
+        return m_commandCount;
+    }
+
+    // Runs the checks building the workload and running it in the closed or open loop would,
+    // so an invalid spec fails before anything is built
+    void validate() const {
+        switch(m_type) {
+            case Type::Graphics: graphicsConfig(); break;
+            case Type::Compute : computeConfig(); break;
+            case Type::Transfer: transferConfig(); break;
+            case Type::Mixed   : mixedConfig(); break;
+        }
+        drawTriangles();
+        commands();
+        clients();
+        buildThreads();
+        threadPolicy("cpu");
+        threadPolicy("submit_cpu");
+        lockMemory();
+        searchConfig();
+        numericOption<unsigned>("solo", 0, 0);
+        numericOption<unsigned>("cache", 16, 1);
+        if (isOpenLoop()) {
+            arrival();
+            rate();
+            numericOption<unsigned>("inflight", 4, 1);
+            numericOption<unsigned>("submissions", 1000, 1);
+            numericOption<uint64_t>("seed", 1, 0);
+        }
+    }
+
+    // draw_triangles:N triangles per draw of gfx and mixed requests, 0 for the whole mesh
+    unsigned drawTriangles() const {
+        return numericOption<unsigned>("draw_triangles", 0, 0);
+    }
+
+    // Whether the device can run the workload on queue, else why not; the workload constructors exit instead
+    bool supports(Base& base, QueueInfo const& queue, std::string* why) const {
         switch(m_type) {
-            case Type::Graphics: return new GraphicsWork(base, queue, commandCount);
-            case Type::Compute : return new ComputeWork(base, queue, commandCount);
+            case Type::Graphics: return GraphicsWork::supports(base, graphicsConfig(), why);
+            case Type::Compute : return ComputeWork::supports(base, computeConfig(), why);
+            case Type::Transfer: return TransferWork::supports(base, queue, transferConfig(), why);
+            case Type::Mixed   : return MixedWork::supports(base, queue, mixedConfig(), why);
+        }
+        return true;
+    }
+
+    // The construction steps of the workload run on pool when given
+    Workload* createWorkload(Base& base, QueueInfo queue, unsigned commandCount, ThreadPool* pool = nullptr) {
+        switch(m_type) {
+            case Type::Graphics: return new GraphicsWork(base, queue, commandCount,
+                drawTriangles(), graphicsConfig(), pool);
+            case Type::Compute : return new ComputeWork(base, queue, commandCount, computeConfig(), pool);
+            case Type::Transfer: return new TransferWork(base, queue, commandCount, transferConfig());
+            case Type::Mixed   : return new MixedWork(base, queue, commandCount,
+                drawTriangles(), mixedConfig(), pool);
         }
 	return nullptr;
     }
 
-    void init(Base& base) {
+    void init(Base& base, ThreadPool* pool = nullptr) {
         auto queue = base.GetQueueInfo(vkQueueFlag(), m_priority);
-        m_workload = createWorkload(base, queue, m_commandCount);
+        m_workload = createWorkload(base, queue, m_commandCount, pool);
+    }
+
+    // build_threads:N sizes the workload construction pool, 0 builds on the calling thread
+    unsigned buildThreads() const {
+        const unsigned fallback = std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
+        return numericOption<unsigned>("build_threads", fallback, 0);
     }
 
     void queryTimestamp(uint64_t time_stamp[], int count) {
@@ -122,21 +489,17 @@ public:
         m_workload->waitIdle();
     }
 
-    VkFence submit(Base& base) {
-        return m_workload->submit();
-    }
-
     static std::vector<Request> rearrangeDelays(std::vector<Request> requests) {
         // Sort the vector in ascending order of delays
         std::sort(requests.begin(), requests.end(), [](Request a, Request b) { return a.m_delay < b.m_delay; });
 
         // The delays do not compound, so subtract the previous one from the current
         auto previous = std::chrono::microseconds::zero();
-        std::cout << "Delays : " << std::endl;
+        LOG("Delays : \n");
         for (auto& request : requests) {
-            std::cout << request.m_delay.count();
+            const long long delay = request.m_delay.count();
             request.m_delay -= previous;
-            std::cout << " -> " << request.m_delay.count() << std::endl;
+            LOG("%lld -> %lld\n", delay, (long long)request.m_delay.count());
             previous = request.m_delay;
         }
 
@@ -145,31 +508,38 @@ public:
 };
 
 #define SOCKET_PATH "/tmp/mysocket"
+// Set by the orchestrator: the server's ends of the client sockets, comma separated, and the client's end
+#define ORCHESTRATOR_FDS_ENV "VKPREEMPTION_FDS"
+#define ORCHESTRATOR_FD_ENV "VKPREEMPTION_FD"
 #define IPC_KEY 0x12345678
 #define TYPE_S 1
 #define TYPE_C 2
 
-struct msgbuff{
-  long mtype;
-  char mtext[512];
-  uint64_t time_stamp[RUN_TIMES * 2];
-};
-
 struct timespec ts;
-struct timespec ts1;
-struct timespec ts2;
-int clifd = -1;
 
-int server()
+// Accepts the connections of clients, or takes the sockets handed over by the orchestrator. Empty on failure.
+std::vector<int> server(unsigned clients)
 {
     int servfd;
     int ret;
+    std::vector<int> fds;
+
+    if (const char* inherited = getenv(ORCHESTRATOR_FDS_ENV)) {
+        const char* fd = inherited;
+        while (*fd) {
+            fds.push_back(atoi(fd));
+            fd += strcspn(fd, ",");
+            fd += *fd == ',';
+        }
+        LOG("Server: %zu client socket(s) from the orchestrator\n", fds.size());
+        return fds;
+    }
 
     servfd = socket(AF_LOCAL,SOCK_STREAM,0);
     if(-1 == servfd)
     {
         perror("Can not create socket");
-        return -1;
+        return fds;
     }
 
     struct sockaddr_un servaddr;
@@ -182,45 +552,53 @@ int server()
     if(-1 == ret)
     {
         perror("bind failed");
-        return -1;
+        close(servfd);
+        return fds;
     }
 
     ret = listen(servfd, 100);
     if(-1 == ret)
     {
         perror("listen failed");
-        return -1;
+        close(servfd);
+        return fds;
     }
 
-    pthread_t tid;
     struct sockaddr_un cliaddr;
 
-    printf("Wait for client connect \n");
-    memset(&cliaddr,0,sizeof(cliaddr));
-    clifd = accept(servfd,(struct sockaddr *)&cliaddr,&addrlen);
-    if(clifd == -1)
-    {
-        printf("accept connect failed\n");
-        return -1;
-    }
-    printf("Accept connect success\n");
-
-    char getData[100];
-    bzero(&getData,sizeof(getData));
-    ret = read(clifd,&getData,sizeof(getData));
-    if(ret > 0)
+    LOG("Wait for %u client(s) to connect\n", clients);
+    while (fds.size() < clients)
     {
-        printf("Receive message: %s", getData);
+        memset(&cliaddr,0,sizeof(cliaddr));
+        socklen_t cliaddrlen = sizeof(cliaddr);
+        const int clifd = accept(servfd,(struct sockaddr *)&cliaddr,&cliaddrlen);
+        if(clifd == -1)
+        {
+            LOG("accept connect failed\n");
+            for (int fd : fds) {
+                close(fd);
+            }
+            fds.clear();
+            break;
+        }
+        fds.push_back(clifd);
+        LOG("Accept connect success\n");
     }
 
-    return 0;
+    close(servfd);
+    return fds;
 }
 
 int client()
 {
     int ret;
 
-    clifd = socket(AF_LOCAL, SOCK_STREAM, 0);
+    if (const char* inherited = getenv(ORCHESTRATOR_FD_ENV)) {
+        LOG("Client: socket from the orchestrator\n");
+        return atoi(inherited);
+    }
+
+    const int clifd = socket(AF_LOCAL, SOCK_STREAM, 0);
     if(-1 == clifd)
     {
         perror("socket create failed\n");
@@ -236,150 +614,1199 @@ int client()
     ret = connect(clifd, (struct sockaddr *)&cileddr, addrlen);
     if(ret == -1) {
         perror("Connect fail\n");
+        close(clifd);
         return -1;
     }
-    const char *s = std::string("hello\n").c_str();
-    send(clifd,s,strlen(s),0);
-    printf("Client: send hello to server\n");
-    return 0;
+    LOG("Client: connected to server\n");
+    return clifd;
 }
 
 uint64_t toTime(timespec ts){
     return ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
+// MCBP verdict: a high-priority iteration that launched after and completed before the
+// low-priority one was preempted into it. Returns the first such iteration or -1.
+int findNestedRun(const uint64_t high[], const uint64_t low[], unsigned runs) {
+    for (unsigned i = 0; i < runs; i++) {
+        if (low[i * 2] < high[i * 2] && low[i * 2 + 1] > high[i * 2 + 1]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void printVerdict(const uint64_t high[], const uint64_t low[], unsigned runs) {
+    const int i = findNestedRun(high, low, runs);
+    if (i >= 0) {
+        LOG("success on(%d) high:%ld low: %ld\n", i, high[i * 2 + 1] - high[i * 2],
+            (low[i * 2 + 1] - low[i * 2]));
+    } else {
+        LOG("run again to trigger mcbp.\n");
+    }
+}
+
+// log:path sends the output to a file instead of stdout, the first request with one decides
+void openLog(std::vector<Request> const& requests) {
+    for (auto const& request : requests) {
+        const std::string path = request.option("log");
+        if (path.empty()) {
+            continue;
+        }
+        if (!Logger::instance().open(path.c_str())) {
+            LOG("Could not open log file %s\n", path.c_str());
+            exit(-1);
+        }
+        return;
+    }
+}
+
+struct Iteration {
+    uint64_t launch;
+    uint64_t completion;
+    int64_t queueWait;
+    std::vector<int64_t> launchErrors;      // of every submission, in submission order
+
+    int64_t worstLaunchError() const {
+        return launchErrors.empty() ? 0 : *std::max_element(launchErrors.begin(), launchErrors.end());
+    }
+};
+
+// Launches the recorded workloads at the deadline, every one once per frame of its ring in rounds, so up to
+// depth submissions of each are queued at once, and waits for all of them
+Iteration launchWorkloads(Timeline& timeline, double timestampPeriod, LaunchScheduler& scheduler, Submitter* submitter,
+    std::vector<Workload*> const& workloads, uint64_t deadline) {
+    std::vector<VkFence> fences;
+    Iteration iteration;
+    unsigned firstFrame = 0, lastFrame = 0;
+
+    iteration.launch = scheduler.waitUntil(deadline);
+    for (unsigned round = 0; round < workloads.front()->depth(); round++) {
+        for (auto workload : workloads) {
+            if (!fences.empty()) {
+                scheduler.recordLaunch(deadline);
+            }
+            fences.push_back(submitter ? submitter->push(workload->prepareSubmit()) : workload->submit());
+            if (fences.size() == 1) {
+                firstFrame = workload->lastFrame();
+            }
+            lastFrame = workload->lastFrame();
+        }
+    }
+
+    timeline.waitForFences(fences);
+    iteration.completion = timeline.now();
+
+    // Host interval minus GPU execution from the first to the last submission. For the high priority
+    // side this is dominated by the lower priority work reaching its preemption point.
+    uint64_t first[2], last[2];
+    workloads.front()->queryTimestamp(firstFrame, first, 2);
+    workloads.back()->queryTimestamp(lastFrame, last, 2);
+    iteration.queueWait = static_cast<int64_t>(iteration.completion - iteration.launch)
+        - static_cast<int64_t>((last[1] - first[0]) * timestampPeriod);
+
+    std::vector<int64_t> const& errors = scheduler.GetLaunchErrors();
+    iteration.launchErrors.assign(errors.end() - fences.size(), errors.end());
+
+    if (submitter) {
+        submitter->drain();
+    }
+    return iteration;
+}
+
+// The progress curve (progress:K) and pipeline statistics (stats:1) of every submission of an iteration,
+// outside the timed part. The curve of a low priority submission shows where in its commands the higher
+// priority work ran.
+void reportSubmissions(Request const& request, std::vector<Workload*> const& workloads, double timestampPeriod, unsigned run) {
+    for (size_t j = 0; j < workloads.size(); j++) {
+        for (unsigned frame = 0; frame < workloads[j]->depth(); frame++) {
+            const std::string submission = "(run " + std::to_string(run) + ", workload " + std::to_string(j)
+                + ", frame " + std::to_string(frame) + ")";
+            if (request.progressInterval() > 0) {
+                workloads[j]->queryProgress(frame, timestampPeriod).print(("Progress" + submission).c_str());
+            }
+            if (request.pipelineStatistics()) {
+                uint64_t stamps[2];
+                workloads[j]->queryTimestamp(frame, stamps, 2);
+                workloads[j]->queryStatistics(frame).print(("Statistics" + submission).c_str(), request.commands(),
+                    static_cast<uint64_t>((stamps[1] - stamps[0]) * timestampPeriod));
+            }
+        }
+    }
+}
+
+// The closed loop of gfx(), on the device or on the simulator: build(run) records the workloads of an iteration,
+// which launch together, the first iteration at firstDeadline and every later one as soon as it is recorded, back
+// to back as the iterations always ran. done(run, iteration, workloads) is called after every iteration, outside
+// the timed part, and owns the workloads.
+void runClosedLoop(Timeline& timeline, double timestampPeriod, LaunchScheduler& scheduler, Submitter* submitter,
+    unsigned runs, uint64_t firstDeadline, std::function<std::vector<Workload*>(unsigned)> const& build,
+    std::function<void(unsigned, Iteration const&, std::vector<Workload*>&)> const& done) {
+    for (unsigned run = 0; run < runs; run++) {
+        std::vector<Workload*> workloads = build(run);
+        const uint64_t deadline = run == 0 ? firstDeadline : timeline.now();
+        const Iteration iteration = launchWorkloads(timeline, timestampPeriod, scheduler, submitter, workloads, deadline);
+        done(run, iteration, workloads);
+    }
+}
+
+struct SimTenant {
+    std::vector<uint64_t> time_stamp;   // empty for open-loop requests
+    std::vector<int64_t> queueWaits;
+    unsigned preemptions = 0;
+};
+
+// Every request runs the loop of gfx() on a thread of its own against one simulated device, one queue per request,
+// all counting their delays from virtual time 0: runClosedLoop, or the load generator for load:fixed|poisson
+std::vector<SimTenant> simulate(std::vector<Request>& requests, SimGpu::Config const& config, unsigned runs) {
+    const unsigned submissionsPerRun = 2;
+    SimDevice device(config);
+    std::vector<SimTenant> tenants(requests.size());
+    std::vector<std::function<void()>> bodies;
+
+    for (unsigned t = 0; t < requests.size(); t++) {
+        bodies.push_back([&, t]() {
+            Request& request = requests[t];
+            SimTenant& tenant = tenants[t];
+            LaunchScheduler scheduler(device, false);
+            const uint64_t delayNs = std::chrono::duration_cast<std::chrono::nanoseconds>(request.m_delay).count();
+            auto createWorkload = [&]() {
+                return new SimWorkload(device, t, request.m_priority, request.vkQueueFlag(), request.commands(), request.frames());
+            };
+
+            if (request.isOpenLoop()) {
+                LoadGenerator generator(device, createWorkload, request.arrival(), request.rate(),
+                    request.numericOption<unsigned>("inflight", 4, 1),
+                    request.numericOption<unsigned>("submissions", 1000, 1),
+                    request.numericOption<uint64_t>("seed", 1, 0));
+                generator.run(delayNs, scheduler);
+                generator.report(("sim " + std::to_string(t)).c_str());
+                return;
+            }
+
+            tenant.time_stamp.resize(runs * 2);
+            tenant.queueWaits.resize(runs);
+            runClosedLoop(device, 1.0, scheduler, nullptr, runs, delayNs,
+                [&](unsigned) {
+                    std::vector<Workload*> workloads;
+                    for (unsigned j = 0; j < submissionsPerRun; j++) {
+                        workloads.push_back(createWorkload());
+                    }
+                    return workloads;
+                },
+                [&](unsigned run, Iteration const& iteration, std::vector<Workload*>& workloads) {
+                    tenant.time_stamp[run * 2] = iteration.launch;
+                    tenant.time_stamp[run * 2 + 1] = iteration.completion;
+                    tenant.queueWaits[run] = iteration.queueWait;
+                    for (auto workload : workloads) {
+                        delete workload;
+                    }
+                });
+            tenant.preemptions = device.preemptions(t);
+        });
+    }
+    device.run(bodies);
+    return tenants;
+}
+
+// The adaptive search on the simulated GPU, between the highest and the lowest priority request
+int simSearch(std::vector<Request> &requests, SimGpu::Config const& config) {
+    auto byPriority = [](Request const& a, Request const& b) { return a.m_priority < b.m_priority; };
+    Request low = *std::min_element(requests.begin(), requests.end(), byPriority);
+    Request high = *std::max_element(requests.begin(), requests.end(), byPriority);
+    if (requests.size() != 2 || high.m_priority < VK_QUEUE_GLOBAL_PRIORITY_HIGH_EXT || low.m_priority >= high.m_priority) {
+        LOG("search needs a high priority request and a lower priority one\n");
+        exit(-1);
+    }
+
+    PreemptionSearch search(high.searchConfig());
+    PreemptionSearch::Trial trial;
+    while (search.next(trial)) {
+        low.m_commandCount = trial.lowCommands;
+        low.m_delay = std::chrono::microseconds::zero();
+        high.m_delay = std::chrono::microseconds(trial.offsetNs / 1000);
+        std::vector<Request> pair = { low, high };
+        const std::vector<SimTenant> tenants = simulate(pair, config, 1);
+        search.record(tenants[1].time_stamp.data(), tenants[0].time_stamp.data(), tenants[1].queueWaits[0]);
+    }
+    search.report("Sim search");
+    return 0;
+}
+
+// Runs the requests in-process on the simulated GPU: the same verdict and fairness report as gfx(), deterministic
+int sim(std::vector<Request> &requests, SimGpu::Config const& config) {
+    openLog(requests);
+    LOG("Simulated GPU: draw %lu ns, dispatch %lu ns, copy %lu ns, switch %lu ns, granularity %lu, preemption %s, "
+        "%u compute engine(s), %u copy engine(s)\n",
+        config.drawNs, config.dispatchNs, config.copyNs, config.switchNs, config.granularity,
+        config.preemption ? "on" : "off", config.computeEngines, config.copyEngines);
+
+    for (auto const& request : requests) {
+        if (request.useSubmitThread()) {
+            LOG("submit:thread is not simulated\n");
+            exit(-1);
+        }
+    }
+    for (auto const& request : requests) {
+        if (request.isSearch()) {
+            return simSearch(requests, config);
+        }
+    }
+
+    // As in simulate(), every iteration submits each of them once per frame
+    const unsigned submissionsPerRun = 2;
+    std::vector<SimTenant> tenants = simulate(requests, config, RUN_TIMES);
+    std::vector<size_t> closed;     // the closed-loop tenants, open-loop ones reported their latencies already
+    for (size_t t = 0; t < requests.size(); t++) {
+        if (!tenants[t].time_stamp.empty()) {
+            closed.push_back(t);
+        }
+    }
+    std::vector<TenantTimeline> timelines;
+
+    for (size_t t : closed) {
+        TenantTimeline timeline;
+        const uint64_t* time_stamp = tenants[t].time_stamp.data();
+        for (int i = 0; i < RUN_TIMES; i++) {
+            LOG("Sim %zu: timestamp %lu %lu total:%ld\n", t, time_stamp[i * 2],
+                time_stamp[i * 2 + 1], (time_stamp[i * 2 + 1] - time_stamp[i * 2]));
+            timeline.intervals.push_back({time_stamp[i * 2], time_stamp[i * 2 + 1]});
+        }
+        LOG("Sim %zu: %u preemption(s)\n", t, tenants[t].preemptions);
+
+        // Solo baseline: the same request alone on an identical GPU
+        std::vector<Request> solo(1, requests[t]);
+        const std::vector<uint64_t> soloStamps = simulate(solo, config, RUN_TIMES)[0].time_stamp;
+        uint64_t total = 0;
+        for (int i = 0; i < RUN_TIMES; i++) {
+            total += soloStamps[i * 2 + 1] - soloStamps[i * 2];
+        }
+
+        timeline.label = "sim " + std::to_string(t);
+        timeline.priority = requests[t].m_priority;
+        timeline.submissionsPerInterval = submissionsPerRun * requests[t].frames();
+        timeline.soloNs = total / RUN_TIMES;
+        timelines.push_back(timeline);
+    }
+
+    for (size_t high : closed) {
+        for (size_t low : closed) {
+            if (requests[high].m_priority >= VK_QUEUE_GLOBAL_PRIORITY_HIGH_EXT
+                    && requests[low].m_priority < requests[high].m_priority) {
+                LOG("Sim %zu over %zu: ", high, low);
+                printVerdict(tenants[high].time_stamp.data(), tenants[low].time_stamp.data(), RUN_TIMES);
+            }
+        }
+    }
+
+    FairnessReport(timelines).print();
+
+    // The GPU start of an iteration is its launch plus its queue wait, as in gfx()
+    OverlapAnalysis analysis;
+    for (size_t t : closed) {
+        const unsigned participant = analysis.addParticipant("sim " + std::to_string(t));
+        for (int i = 0; i < RUN_TIMES; i++) {
+            const uint64_t launch = tenants[t].time_stamp[i * 2];
+            analysis.add(participant, requests[t].m_priority, launch,
+                launch + std::max<int64_t>(tenants[t].queueWaits[i], 0), tenants[t].time_stamp[i * 2 + 1]);
+        }
+    }
+    analysis.run();
+    analysis.print();
+    return 0;
+}
+
 int gfx(std::vector<Request> &requests, bool isServer) {
+    openLog(requests);
     std::vector<VkQueueGlobalPriorityEXT> graphic_priorities;
     std::vector<VkQueueGlobalPriorityEXT> compute_priorities;
+    std::vector<VkQueueGlobalPriorityEXT> transfer_priorities;
     Request& request = requests.back();
 
     switch(request.m_type) {
-        case Request::Type::Graphics: graphic_priorities.push_back(request.m_priority); break;
+        case Request::Type::Graphics:
+        case Request::Type::Mixed   : graphic_priorities.push_back(request.m_priority); break;
         case Request::Type::Compute : compute_priorities.push_back(request.m_priority); break;
+        case Request::Type::Transfer: transfer_priorities.push_back(request.m_priority); break;
     }
 
-    Base base(graphic_priorities, compute_priorities);
+    Base base(graphic_priorities, compute_priorities, transfer_priorities);
+
+    // Started before any pinning below so the pool threads keep the default placement
+    std::unique_ptr<ThreadPool> pool;
+    if (request.buildThreads() > 0) {
+        pool.reset(new ThreadPool(request.buildThreads()));
+    }
 
-    printf("Waiting %lld us ... \n", request.m_delay.count());
-    fflush(stdout);
-    std::this_thread::sleep_for(request.m_delay);
+    if (request.lockMemory()) {
+        lockMemory();
+    }
+    // Applied after device creation so driver threads keep the default placement
+    const ThreadPolicy mainPolicy = request.threadPolicy("cpu");
+    if (!mainPolicy.empty()) {
+        mainPolicy.apply("submit/wait thread");
+    }
 
-    int msgid = -1;
+    // Started before calibration so the submission thread runs with its own policy by then
+    std::unique_ptr<Submitter> submitter;
+    if (request.useSubmitThread()) {
+        const ThreadPolicy submitPolicy = request.threadPolicy("submit_cpu");
+        submitter.reset(new Submitter(base.GetQueueInfo(request.vkQueueFlag(), request.m_priority).queue,
+            [submitPolicy]() {
+                if (!submitPolicy.empty()) {
+                    submitPolicy.apply("submission thread");
+                }
+            }));
+    }
 
-    int i, j;
+    // Calibrate before the rendezvous so it does not skew the start of either side
+    HostTimeline timeline(base.GetDevice());
+    LaunchScheduler scheduler(timeline);
+    const uint64_t delayNs = std::chrono::duration_cast<std::chrono::nanoseconds>(request.m_delay).count();
+
+    // Open-loop workloads are built up front so the first arrivals are not late
+    std::unique_ptr<LoadGenerator> generator;
+    if (request.isOpenLoop()) {
+        const QueueInfo queue = base.GetQueueInfo(request.vkQueueFlag(), request.m_priority);
+        generator.reset(new LoadGenerator(timeline,
+            [&]() { return request.createWorkload(base, queue, request.m_commandCount, pool.get()); },
+            request.arrival(),
+            request.rate(),
+            request.numericOption<unsigned>("inflight", 4, 1),
+            request.numericOption<unsigned>("submissions", 1000, 1),
+            request.numericOption<uint64_t>("seed", 1, 0)));
+    }
 
-    struct msgbuff buf;
-    memset(&buf, 0x00, sizeof(struct msgbuff));
+    // Workloads own device memory and objects. They are released before the footprint is reported on every
+    // way out of gfx(), and so before Base, rather than by ~Request after Base is gone.
+    auto releaseWorkloads = [&]() {
+        generator.reset();
+        if (request.m_workload != nullptr) {
+            request.waitIdle();
+            delete request.m_workload;
+            request.m_workload = nullptr;
+        }
+    };
 
+    int i;
 
+    // The server picks the start time all sides count their delays from. A client without a server runs alone.
+    std::unique_ptr<Connection> connection;             // the client's, to the server
+    std::vector<std::unique_ptr<Connection>> clients;   // the server's, one per client
     if (isServer)
     {
-        msgid = server();
-        if(msgid < 0)
+        const std::vector<int> fds = server(request.clients());
+        if(fds.empty())
         {
-            perror("Server: msgget error");
+            perror("Server: accept error");
             exit(-1);
         }
+        for (int fd : fds) {
+            clients.emplace_back(new Connection(fd));
+            if (!handshake(*clients.back(), Role::Server, RUN_TIMES)) {
+                LOG("Server: handshake with client %zu failed\n", clients.size() - 1);
+                exit(-1);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        for (auto const& client : clients) {
+            client->send(MessageType::Start, MessageWriter().u64(toTime(ts)));
+        }
     }
     else {
-        msgid = client();
-        if(msgid < 0)
+        const int fd = client();
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if(fd < 0)
         {
             perror("Client: error , please start server first\n");
-            //exit(-1);
+        }
+        else
+        {
+            connection.reset(new Connection(fd));
+            Message start;
+            if (!handshake(*connection, Role::Client, RUN_TIMES) || !connection->receive(MessageType::Start, start)) {
+                LOG("Client: handshake with the server failed\n");
+                exit(-1);
+            }
+            const uint64_t startNs = MessageReader(start).u64();
+            ts.tv_sec = startNs / 1000000000ull;
+            ts.tv_nsec = startNs % 1000000000ull;
         }
     }
 
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-
     if (isServer)
     {
-        printf("Server: start submission time: <%ld.%ld>\n",ts.tv_sec,ts.tv_nsec);
+        LOG("Server: start submission time: <%ld.%ld>\n",ts.tv_sec,ts.tv_nsec);
     }
     else
     {
-        printf("Client: start submission time: <%ld.%ld>\n",ts.tv_sec,ts.tv_nsec);
+        LOG("Client: start submission time: <%ld.%ld>\n",ts.tv_sec,ts.tv_nsec);
     }
 
 
     uint64_t time_stamp[RUN_TIMES * 2];
 
 
-    std::vector<VkFence> fences;
+    // Open-loop runs only share the start time with the other side: there is no sample exchange and no
+    // verdict, each side reports its own latencies
+    if (generator) {
+        generator->run(toTime(ts) + delayNs, scheduler, submitter.get());
 
-    for (i = 0; i < RUN_TIMES; i++) {
+        const std::string label = std::string(isServer ? "server" : "client") + " priority " + std::to_string(request.m_priority);
+        generator->report(label.c_str());
+        releaseWorkloads();
+        base.GetMemoryTracker().report();
+        return 0;
+    }
 
-        fences.clear();
-        clock_gettime(CLOCK_MONOTONIC, &ts1);
+    const unsigned submissionsPerRun = 2;
+
+    const double timestampPeriod = base.GetPhysicalDeviceProperties().limits.timestampPeriod;
+
+    // runClosedLoop on the device with the workloads of the request. waits[] gets the part of each iteration the queue spent waiting rather
+    // than executing on the GPU. done(run, iteration) is called after every iteration, outside the timed part
+    auto runIterations = [&](unsigned runs, uint64_t firstDeadline, uint64_t stamps[], int64_t waits[],
+            std::function<void(unsigned, Iteration const&)> const& done = nullptr) {
+        runClosedLoop(timeline, timestampPeriod, scheduler, submitter.get(), runs, firstDeadline,
+            [&](unsigned run) {
+                LOG("pid %d running: %d \n", getpid(), run);
+                // Workload construction uploads through the queue, so record everything before the launch
+                const QueueInfo queue = base.GetQueueInfo(request.vkQueueFlag(), request.m_priority);
+                std::vector<Workload*> workloads(submissionsPerRun);
+                TaskGroup tasks(pool.get());
+                for (unsigned j = 0; j < submissionsPerRun; j++) {
+                    tasks.run([&, j]() { workloads[j] = request.createWorkload(base, queue, request.m_commandCount, pool.get()); });
+                }
+                tasks.wait();
+                return workloads;
+            },
+            [&](unsigned run, Iteration const& iteration, std::vector<Workload*>& workloads) {
+                stamps[run * 2] = iteration.launch;
+                stamps[run * 2 + 1] = iteration.completion;
+                waits[run] = iteration.queueWait;
+                if (request.progressInterval() > 0 || request.pipelineStatistics()) {
+                    reportSubmissions(request, workloads, timestampPeriod, run);
+                }
+
+                // Only the last workload is kept, for waitIdle() at the end; the search runs many iterations
+                delete request.m_workload;
+                request.m_workload = workloads.back();
+                for (unsigned j = 0; j + 1 < workloads.size(); j++) {
+                    delete workloads[j];
+                }
+                if (done) {
+                    done(run, iteration);
+                }
+            });
+    };
 
-        printf("pid %d running: %d \n", getpid(), i);
-        for (j = 0; j < 2; j++) {
-            request.init(base);
-            fflush(stdout);
-            fences.push_back(request.submit(base));
+    // search:1 on both sides. The server runs the high priority side and the search: it sends the client
+    // the size and absolute launch time of every trial and gets the client's interval back.
+    if (request.isSearch()) {
+        if (isServer) {
+            if (request.m_priority < VK_QUEUE_GLOBAL_PRIORITY_HIGH_EXT || clients.size() != 1) {
+                LOG("search needs the server to run the high priority request against one client\n");
+                exit(-1);
+            }
+            Connection& peer = *clients.front();
+            PreemptionSearch search(request.searchConfig());
+            PreemptionSearch::Trial trial;
+            uint64_t leadNs = 20000000;     // both sides record their workloads before the launch
+            while (search.next(trial)) {
+                const uint64_t lowStart = monotonicNs() + leadNs;
+                peer.send(MessageType::Trial, MessageWriter().u32(trial.lowCommands).u64(lowStart));
+                uint64_t high[2];
+                int64_t wait;
+                runIterations(1, lowStart + trial.offsetNs, high, &wait);
+                Message message;
+                if (!peer.receive(MessageType::Sample, message)) {
+                    LOG("Search: client disconnected\n");
+                    exit(-1);
+                }
+                const Sample sample = Sample::read(message);
+                const uint64_t low[2] = { sample.launch, sample.completion };
+                // A late launch means recording did not fit in the lead time
+                if (low[0] > lowStart + 1000000 || high[0] > lowStart + trial.offsetNs + 1000000) {
+                    leadNs *= 2;
+                }
+                search.record(high, low, wait);
+            }
+            peer.send(MessageType::Trial, MessageWriter().u32(0).u64(0));
+            search.report("Search");
+        } else if (connection) {
+            Message message;
+            while (connection->receive(MessageType::Trial, message)) {
+                MessageReader reader(message);
+                request.m_commandCount = reader.u32();
+                const uint64_t lowStart = reader.u64();
+                if (request.m_commandCount == 0) {
+                    break;
+                }
+                uint64_t low[2];
+                int64_t wait;
+                runIterations(1, lowStart, low, &wait, [&](unsigned, Iteration const& iteration) {
+                    const Sample sample = { 0, low[0], low[1], wait, iteration.worstLaunchError() };
+                    sample.write(*connection);
+                });
+            }
+        }
+        releaseWorkloads();
+        base.GetMemoryTracker().report();
+        return 0;
+    }
+
+    LOG("Delay %lld us, first launch at %lu\n", (long long)request.m_delay.count(), toTime(ts) + delayNs);
+    int64_t queueWaits[RUN_TIMES];
+
+    // Every client streams its iterations as they complete; the server takes them in between its own
+    // iterations and reports preemptions while the run is still going
+    struct ClientRun {
+        std::string label;
+        std::vector<Sample> samples;
+        bool received = false;      // its summary
+        int32_t priority = 0;
+        uint32_t submissionsPerRun = 0;
+        uint64_t soloNs = 0;
+    };
+    std::vector<ClientRun> clientRuns(clients.size());
+    for (size_t c = 0; c < clients.size(); c++) {
+        clientRuns[c].label = clients.size() == 1 ? "client" : "client " + std::to_string(c);
+    }
+    auto takeSample = [&](size_t c, Message const& message) {
+        if (message.type == MessageType::Sample) {
+            clientRuns[c].samples.push_back(Sample::read(message));
+        }
+    };
+    std::vector<std::vector<int64_t>> launchErrors(RUN_TIMES);
+    runIterations(RUN_TIMES, toTime(ts) + delayNs, time_stamp, queueWaits, [&](unsigned run, Iteration const& iteration) {
+        launchErrors[run] = iteration.launchErrors;
+        if (!isServer) {
+            if (connection) {
+                const Sample sample = { run, time_stamp[run * 2], time_stamp[run * 2 + 1], queueWaits[run],
+                    iteration.worstLaunchError() };
+                sample.write(*connection);
+            }
+            return;
         }
+        for (size_t c = 0; c < clients.size(); c++) {
+            Message message;
+            std::vector<Sample> const& samples = clientRuns[c].samples;
+            const size_t known = samples.size();
+            while (clients[c]->tryReceive(message)) {
+                takeSample(c, message);
+            }
+            for (size_t j = known; j < samples.size(); j++) {
+                Sample const& low = samples[j];
+                for (unsigned k = 0; k <= run; k++) {
+                    if (low.launch < time_stamp[k * 2] && low.completion > time_stamp[k * 2 + 1]) {
+                        LOG("Server: iteration %u ran inside %s iteration %u\n", k, clientRuns[c].label.c_str(), low.iteration);
+                    }
+                }
+            }
+        }
+    });
 
-        VK_CHECK_RESULT(vkWaitForFences(base.GetDevice(), fences.size(), fences.data(), VK_TRUE, UINT64_MAX));
-        clock_gettime(CLOCK_MONOTONIC, &ts2);
-        time_stamp[i * 2] = toTime(ts1);
-        time_stamp[i * 2 + 1] = toTime(ts2);
+    for (i = 0; i < RUN_TIMES; i++) {
+        for (size_t j = 0; j < launchErrors[i].size(); j++) {
+            LOG("launch error(%d, submission %zu): %ld ns\n", i, j, launchErrors[i][j]);
+        }
+        LOG("queue wait(%d): %ld ns\n", i, queueWaits[i]);
+    }
 
+    if (submitter) {
+        for (auto const& submission : submitter->GetHistory()) {
+            LOG("submit thread: enqueue %lu submit %lu queued %lu ns\n", submission.enqueueTime,
+                submission.submitTime, submission.submitTime - submission.enqueueTime);
+        }
     }
 
+    // solo:N measures a baseline after the contended runs, one side at a time: once every client reported
+    // Done, the server runs alone first, then releases the clients to run alone one after another
+    const unsigned soloRuns = request.numericOption<unsigned>("solo", 0, 0);
+    auto soloBaseline = [&]() -> uint64_t {
+        if (soloRuns == 0) {
+            return 0;
+        }
+        std::vector<uint64_t> stamps(soloRuns * 2);
+        std::vector<int64_t> waits(soloRuns);
+        runIterations(soloRuns, monotonicNs() + delayNs, stamps.data(), waits.data());
+        uint64_t total = 0;
+        for (unsigned run = 0; run < soloRuns; run++) {
+            total += stamps[run * 2 + 1] - stamps[run * 2];
+        }
+        LOG("Solo baseline: %u runs, mean %lu ns\n", soloRuns, total / soloRuns);
+        return total / soloRuns;
+    };
 
     if (isServer)
     {
-        int ret;
-        memset(&buf, 0x00, sizeof(struct msgbuff));
-        ret = read(clifd, &buf, sizeof(buf));
-        if(ret > 0)
-        {
-            printf("Receive message: client %s\n", buf.mtext);
+        // A client still in its contended runs would overlap the solo baselines
+        for (size_t c = 0; c < clients.size(); c++) {
+            Message message;
+            if (!clients[c]->receive(MessageType::Done, message, [&](Message const& other) { takeSample(c, other); })) {
+                LOG("Server: %s did not finish its contended runs\n", clientRuns[c].label.c_str());
+            }
+        }
+        const uint64_t soloNs = soloBaseline();
+
+        // Clients run their solo baselines one after another. The rest of each one's samples, then its summary.
+        for (size_t c = 0; c < clients.size(); c++) {
+            ClientRun& client = clientRuns[c];
+            clients[c]->send(MessageType::Release);
+            Message message;
+            client.received = clients[c]->receive(MessageType::Summary, message,
+                [&](Message const& other) { takeSample(c, other); });
+            MessageReader summary(message);
+            client.priority = summary.u32();
+            client.submissionsPerRun = summary.u32();
+            client.soloNs = summary.u64();
+            if (client.received)
+            {
+                LOG("Receive message: %s summary, %zu iteration(s)\n", client.label.c_str(), client.samples.size());
+            }
         }
 
+        std::vector<TenantTimeline> tenants(1);
+        tenants[0].label = "server";
+        tenants[0].priority = request.m_priority;
+        tenants[0].submissionsPerInterval = submissionsPerRun * request.frames();
+        tenants[0].soloNs = soloNs;
         for (i = 0; i < RUN_TIMES; i++) {
-            if (request.m_priority >= VK_QUEUE_GLOBAL_PRIORITY_HIGH_EXT
-                    && buf.time_stamp[i * 2] < time_stamp[i * 2]
-                    && buf.time_stamp[i * 2 + 1] > time_stamp[i * 2 + 1]) {
-                printf("success on(%d) high:%ld low: %ld\n",i,  time_stamp[i * 2 + 1] - time_stamp[i * 2],
-                    (buf.time_stamp[i * 2 + 1] - buf.time_stamp[i * 2]));
-                break;
+            tenants[0].intervals.push_back({time_stamp[i * 2], time_stamp[i * 2 + 1]});
+        }
+
+        // The GPU start of an iteration is estimated as its launch plus its queue wait
+        OverlapAnalysis analysis;
+        const unsigned server = analysis.addParticipant("server");
+        for (i = 0; i < RUN_TIMES; i++) {
+            analysis.add(server, request.m_priority, time_stamp[i * 2],
+                time_stamp[i * 2] + std::max<int64_t>(queueWaits[i], 0), time_stamp[i * 2 + 1]);
+        }
+
+        for (auto const& client : clientRuns) {
+            // A client may run a different number of iterations
+            uint64_t client_stamp[RUN_TIMES * 2] = {};
+            int64_t clientWaits[RUN_TIMES] = {};
+            unsigned runs = 0;
+            for (auto const& sample : client.samples) {
+                if (sample.iteration < RUN_TIMES) {
+                    client_stamp[sample.iteration * 2] = sample.launch;
+                    client_stamp[sample.iteration * 2 + 1] = sample.completion;
+                    clientWaits[sample.iteration] = sample.queueWait;
+                    runs = std::max(runs, sample.iteration + 1);
+                }
+            }
+
+            if (clientRuns.size() > 1) {
+                LOG("Server over %s: ", client.label.c_str());
+            }
+            if (request.m_priority >= VK_QUEUE_GLOBAL_PRIORITY_HIGH_EXT) {
+                printVerdict(time_stamp, client_stamp, RUN_TIMES);
+            } else {
+                LOG("run again to trigger mcbp.\n");
+            }
+
+            if (client.received) {
+                TenantTimeline tenant;
+                tenant.label = client.label;
+                tenant.priority = client.priority;
+                tenant.submissionsPerInterval = client.submissionsPerRun;
+                tenant.soloNs = client.soloNs;
+                const unsigned participant = analysis.addParticipant(client.label);
+                for (unsigned j = 0; j < runs; j++) {
+                    tenant.intervals.push_back({client_stamp[j * 2], client_stamp[j * 2 + 1]});
+                    analysis.add(participant, client.priority, client_stamp[j * 2],
+                        client_stamp[j * 2] + std::max<int64_t>(clientWaits[j], 0), client_stamp[j * 2 + 1]);
+                }
+                tenants.push_back(tenant);
             }
         }
-        if (i == RUN_TIMES) {
-            printf("run again to trigger mcbp.\n");
+
+        if (tenants.size() > 1) {
+            FairnessReport(tenants).print();
+            analysis.run();
+            analysis.print();
         }
     }
     else
     {
-        int ret;
-        memset(&buf, 0x00, sizeof(struct msgbuff));
-        memcpy(buf.time_stamp, time_stamp, sizeof(time_stamp));
-        strcpy(buf.mtext, "gpu timestamp");
-        send(clifd, &buf, sizeof(buf), 0);
+        Message message;
+        if (connection) {
+            connection->send(MessageType::Done);
+            connection->flush();
+            connection->receive(MessageType::Release, message);
+        }
+        const uint64_t soloNs = soloBaseline();
+
+        if (connection) {
+            connection->send(MessageType::Summary, MessageWriter().u32(request.m_priority).u32(submissionsPerRun * request.frames())
+                .u64(soloNs).u32(RUN_TIMES));
+            connection->flush();
+        }
         for (i = 0; i < RUN_TIMES; i++) {
-            printf("Client: gpu timestamp %lu %lu total:%ld\n", buf.time_stamp[i * 2],
-                buf.time_stamp[i * 2 + 1], (time_stamp[i * 2 + 1] - time_stamp[i * 2]));
+            LOG("Client: gpu timestamp %lu %lu total:%ld\n", time_stamp[i * 2],
+                time_stamp[i * 2 + 1], (time_stamp[i * 2 + 1] - time_stamp[i * 2]));
         }
     }
 
-    request.waitIdle();
+    releaseWorkloads();
+    base.GetMemoryTracker().report();
 
     return 0;
 }
 
-int main(int argc, char *argv[]) {
+#define DAEMON_SOCKET_PATH "/tmp/mysocket.daemon"
+
+// Abstract socket address, as server() and client() use
+socklen_t abstractAddress(const char* path, struct sockaddr_un* addr) {
+    bzero(addr, sizeof(*addr));
+    strcpy(addr->sun_path + 1, path);
+    addr->sun_family = AF_LOCAL;
+    return sizeof(addr->sun_family) + strlen(path) + 1;
+}
+
+/*
+    Daemon mode: creates the device with a queue for every request on the command line, builds their
+    workloads and then runs experiments sent by "e" clients, one connection at a time. Base, the
+    calibrated launch scheduler, the build pool and the workloads stay alive between experiments;
+    workloads are cached by request, up to cache:N (default 16) different requests. Every experiment
+    streams a Sample per iteration, then a Summary (status 0, cached, build ns).
+*/
+int runDaemon(std::vector<Request> &requests) {
+    openLog(requests);
+    std::vector<VkQueueGlobalPriorityEXT> graphic_priorities;
+    std::vector<VkQueueGlobalPriorityEXT> compute_priorities;
+    std::vector<VkQueueGlobalPriorityEXT> transfer_priorities;
+    for (auto& request : requests) {
+        auto& priorities = request.vkQueueFlag() == VK_QUEUE_GRAPHICS_BIT ? graphic_priorities
+            : request.vkQueueFlag() == VK_QUEUE_COMPUTE_BIT ? compute_priorities : transfer_priorities;
+        if (std::find(priorities.begin(), priorities.end(), request.m_priority) == priorities.end()) {
+            priorities.push_back(request.m_priority);
+        }
+    }
+
+    Base base(graphic_priorities, compute_priorities, transfer_priorities);
+    std::unique_ptr<ThreadPool> pool;
+    if (requests.front().buildThreads() > 0) {
+        pool.reset(new ThreadPool(requests.front().buildThreads()));
+    }
+    HostTimeline timeline(base.GetDevice());
+    LaunchScheduler scheduler(timeline);
+    WorkloadCache cache(requests.front().numericOption<unsigned>("cache", 16, 1));
+    const double timestampPeriod = base.GetPhysicalDeviceProperties().limits.timestampPeriod;
+    const unsigned submissionsPerRun = 2;
+
+    auto workloadsFor = [&](Request& request, bool* hit) {
+        return cache.get(request.cacheKey(), [&]() {
+            const QueueInfo queue = base.GetQueueInfo(request.vkQueueFlag(), request.m_priority);
+            std::vector<Workload*> workloads(submissionsPerRun);
+            TaskGroup tasks(pool.get());
+            for (unsigned j = 0; j < submissionsPerRun; j++) {
+                tasks.run([&, j]() { workloads[j] = request.createWorkload(base, queue, request.m_commandCount, pool.get()); });
+            }
+            tasks.wait();
+            return workloads;
+        }, hit);
+    };
+
+    for (auto& request : requests) {
+        bool hit;
+        workloadsFor(request, &hit);
+    }
+
+    const int servfd = socket(AF_LOCAL, SOCK_STREAM, 0);
+    struct sockaddr_un servaddr;
+    const socklen_t addrlen = abstractAddress(DAEMON_SOCKET_PATH, &servaddr);
+    if (servfd == -1 || bind(servfd, (struct sockaddr *)&servaddr, addrlen) == -1 || listen(servfd, 100) == -1) {
+        perror("Daemon: socket failed");
+        return -1;
+    }
+    LOG("Daemon: ready, %zu workload set(s) cached\n", cache.size());
+
+    while (true) {
+        const int fd = accept(servfd, nullptr, nullptr);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // Out of descriptors or memory: back off until finished experiments release some
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                LOG("Daemon: accept failed: %s, retrying\n", strerror(errno));
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            perror("Daemon: accept failed");
+            return -1;
+        }
+        Connection connection(fd);
+        if (!handshake(connection, Role::Daemon, RUN_TIMES)) {
+            continue;
+        }
+        Message message;
+        while (connection.receive(MessageType::Experiment, message)) {
+            const std::string spec = MessageReader(message).str();
+
+            // The connection stays up, the client may go on with other experiments
+            std::unique_ptr<Request> parsed;
+            std::string reason;
+            try {
+                parsed.reset(new Request(spec.c_str(), true));
+                parsed->validate();
+            } catch (std::runtime_error const& error) {
+                reason = error.what();
+                if (!reason.empty() && reason.back() == '\n') {
+                    reason.pop_back();
+                }
+            }
+            if (!reason.empty()) {
+                LOG("Daemon: invalid experiment '%s': %s\n", spec.c_str(), reason.c_str());
+                connection.send(MessageType::Error, MessageWriter().str("invalid experiment '" + spec + "': " + reason));
+                continue;
+            }
+            Request& request = *parsed;
+            if (!base.HasQueue(request.vkQueueFlag(), request.m_priority)) {
+                LOG("Daemon: no queue for '%s'\n", spec.c_str());
+                connection.send(MessageType::Error, MessageWriter().str("no queue for '" + spec + "', start the daemon with such a request"));
+                continue;
+            }
+            std::string why;
+            if (!request.supports(base, base.GetQueueInfo(request.vkQueueFlag(), request.m_priority), &why)) {
+                LOG("Daemon: '%s' is not supported: %s\n", spec.c_str(), why.c_str());
+                connection.send(MessageType::Error, MessageWriter().str("'" + spec + "' is not supported: " + why));
+                continue;
+            }
+
+            const uint64_t buildStart = monotonicNs();
+            bool hit;
+            const std::vector<Workload*> workloads = workloadsFor(request, &hit);
+            const uint64_t buildNs = hit ? 0 : monotonicNs() - buildStart;
+
+            const uint64_t delayNs = std::chrono::duration_cast<std::chrono::nanoseconds>(request.m_delay).count();
+            for (unsigned i = 0; i < RUN_TIMES; i++) {
+                // Only the first launch is delayed, as in gfx()
+                const uint64_t deadline = i == 0 ? monotonicNs() + delayNs : monotonicNs();
+                const Iteration iteration = launchWorkloads(timeline, timestampPeriod, scheduler, nullptr, workloads, deadline);
+                const Sample sample = { i, iteration.launch, iteration.completion, iteration.queueWait,
+                    iteration.worstLaunchError() };
+                sample.write(connection);
+                if (request.progressInterval() > 0 || request.pipelineStatistics()) {
+                    reportSubmissions(request, workloads, timestampPeriod, i);
+                }
+            }
+            connection.send(MessageType::Summary, MessageWriter().u32(0).u32(hit).u64(buildNs));
+            LOG("Daemon: ran '%s', %s, cache %lu hit(s) %lu miss(es)\n", spec.c_str(),
+                hit ? "cached" : "built", cache.hits(), cache.misses());
+            base.GetMemoryTracker().report();
+        }
+    }
+    return 0;
+}
+
+// Experiment mode: runs every request on the daemon in turn and prints the results
+int experiment(int count, char* specs[]) {
+    const int fd = socket(AF_LOCAL, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    const socklen_t addrlen = abstractAddress(DAEMON_SOCKET_PATH, &addr);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, addrlen) == -1) {
+        perror("Experiment: connect to the daemon failed");
+        return -1;
+    }
+    Connection connection(fd);
+    if (!handshake(connection, Role::Experiment, RUN_TIMES)) {
+        LOG("Experiment: handshake with the daemon failed\n");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        // Parsed here first, so a bad spec stops the client rather than the daemon
+        Request request(specs[i]);
+        request.validate();
+        const uint64_t start = monotonicNs();
+        connection.send(MessageType::Experiment, MessageWriter().str(specs[i]));
+
+        // Samples are printed as the daemon streams them
+        bool done = false;
+        Message message;
+        while (!done) {
+            if (!connection.receive(message)) {
+                LOG("Experiment: daemon disconnected\n");
+                return -1;
+            }
+            switch (message.type) {
+            case MessageType::Sample: {
+                const Sample sample = Sample::read(message);
+                LOG("Experiment: timestamp %lu %lu total:%ld launch error %ld ns queue wait %ld ns\n",
+                    sample.launch, sample.completion, (int64_t)(sample.completion - sample.launch),
+                    sample.launchError, sample.queueWait);
+                break;
+            }
+            case MessageType::Summary: {
+                MessageReader reader(message);
+                reader.u32();
+                const bool cached = reader.u32() != 0;
+                const uint64_t buildNs = reader.u64();
+                LOG("Experiment '%s': %lu ns round trip, workloads %s\n", specs[i], monotonicNs() - start,
+                    cached ? "cached" : ("built in " + std::to_string(buildNs) + " ns").c_str());
+                done = true;
+                break;
+            }
+            case MessageType::Error:
+                LOG("Experiment: the daemon refused it: %s\n", MessageReader(message).str().c_str());
+                done = true;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+    Orchestrator mode: runs a whole scenario from one command. The first request is the server, every
+    other one a client, "N*request" stands for N clients with the same request. Every participant is this
+    binary in s or c mode in a process of its own, connected to the server through a socketpair handed
+    down in VKPREEMPTION_FDS and VKPREEMPTION_FD, so concurrent runs do not share a socket name. The
+    server gets clients:N and reports on all clients together. Affinity and scheduling stay per request
+    (cpu, sched, ...). The output of every participant is relayed with its name in front; when one of them
+    fails the others are stopped.
+*/
+int orchestrate(int count, char* specs[]) {
+    struct Participant {
+        std::string name;
+        const char* mode;
+        std::string spec;
+        pid_t pid = -1;
+        int output = -1;            // read end of its stdout and stderr
+        std::string pending;        // output after the last newline
+        int status = 0;
+        uint64_t startNs = 0;
+        uint64_t endNs = 0;
+    };
+
+    std::vector<Participant> participants;
+    for (int i = 0; i < count; i++) {
+        std::string spec = specs[i];
+        unsigned copies = 1;
+        const size_t star = spec.find('*');
+        if (i > 0 && star != std::string::npos && star > 0 && spec.find_first_not_of("0123456789") == star) {
+            copies = std::stoi(spec.substr(0, star));
+            spec = spec.substr(star + 1);
+        }
+        // Parsed here first, so a bad spec stops before anything is started
+        Request request(spec.c_str());
+        for (unsigned j = 0; j < copies; j++) {
+            Participant participant;
+            participant.mode = i == 0 ? "s" : "c";
+            participant.spec = spec;
+            participants.push_back(participant);
+        }
+    }
+    const size_t clients = participants.size() - 1;
+    if (clients == 0) {
+        LOG("Orchestrator: needs a server request and at least one client request\n");
+        return -1;
+    }
+    Request serverRequest(participants[0].spec.c_str());
+    if (serverRequest.m_options.count("clients") && serverRequest.clients() != clients) {
+        LOG("Orchestrator: the server request expects %u client(s), the scenario has %zu\n", serverRequest.clients(), clients);
+        return -1;
+    }
+    if (!serverRequest.m_options.count("clients")) {
+        participants[0].spec += ",clients:" + std::to_string(clients);
+    }
+    participants[0].name = "server";
+    for (size_t c = 0; c < clients; c++) {
+        participants[c + 1].name = clients == 1 ? "client" : "client " + std::to_string(c);
+    }
+
+    // The server's and the client's end of a socket for every client
+    std::vector<int> serverEnds, clientEnds;
+    for (size_t c = 0; c < clients; c++) {
+        int ends[2];
+        if (socketpair(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0, ends) == -1) {
+            perror("Orchestrator: socketpair failed");
+            return -1;
+        }
+        serverEnds.push_back(ends[0]);
+        clientEnds.push_back(ends[1]);
+    }
+
+    for (size_t p = 0; p < participants.size(); p++) {
+        Participant& participant = participants[p];
+        // Everything the child needs is built before the fork, it only calls async-signal-safe functions
+        std::vector<int> inherited;
+        std::string variable;
+        if (p == 0) {
+            inherited = serverEnds;
+            variable = ORCHESTRATOR_FDS_ENV "=";
+            for (size_t c = 0; c < clients; c++) {
+                variable += (c ? "," : "") + std::to_string(serverEnds[c]);
+            }
+        } else {
+            inherited.push_back(clientEnds[p - 1]);
+            variable = ORCHESTRATOR_FD_ENV "=" + std::to_string(clientEnds[p - 1]);
+        }
+        std::vector<char*> envp;
+        for (char** env = environ; *env; env++) {
+            envp.push_back(*env);
+        }
+        envp.push_back(&variable[0]);
+        envp.push_back(nullptr);
+        char self[] = "vkpreemption";
+        std::vector<char*> argv = { self, const_cast<char*>(participant.mode), &participant.spec[0], nullptr };
+
+        int output[2];
+        if (pipe2(output, O_CLOEXEC) == -1) {
+            perror("Orchestrator: pipe failed");
+            return -1;
+        }
+        participant.startNs = monotonicNs();
+        participant.pid = fork();
+        if (participant.pid == -1) {
+            perror("Orchestrator: fork failed");
+            return -1;
+        }
+        if (participant.pid == 0) {
+            dup2(output[1], STDOUT_FILENO);
+            dup2(output[1], STDERR_FILENO);
+            for (int fd : inherited) {
+                fcntl(fd, F_SETFD, 0);
+            }
+            execve("/proc/self/exe", argv.data(), envp.data());
+            _exit(127);
+        }
+        close(output[1]);
+        participant.output = output[0];
+        LOG("Orchestrator: started %s (pid %d): %s\n", participant.name.c_str(), participant.pid, participant.spec.c_str());
+    }
+    for (size_t c = 0; c < clients; c++) {
+        close(serverEnds[c]);
+        close(clientEnds[c]);
+    }
+
+    // Relay the output line by line until every participant closed it, i.e. exited
+    bool stopping = false;
+    size_t running = participants.size();
+    while (running > 0) {
+        std::vector<struct pollfd> pfds;
+        std::vector<size_t> polled;
+        for (size_t p = 0; p < participants.size(); p++) {
+            if (participants[p].output >= 0) {
+                pfds.push_back({ participants[p].output, POLLIN, 0 });
+                polled.push_back(p);
+            }
+        }
+        if (poll(pfds.data(), pfds.size(), -1) == -1) {
+            continue;
+        }
+        for (size_t k = 0; k < pfds.size(); k++) {
+            if (!pfds[k].revents) {
+                continue;
+            }
+            Participant& participant = participants[polled[k]];
+            char buffer[4096];
+            const ssize_t length = read(participant.output, buffer, sizeof(buffer));
+            if (length > 0) {
+                participant.pending.append(buffer, length);
+                size_t newline;
+                while ((newline = participant.pending.find('\n')) != std::string::npos) {
+                    LOG("[%s] %s\n", participant.name.c_str(), participant.pending.substr(0, newline).c_str());
+                    participant.pending.erase(0, newline + 1);
+                }
+                continue;
+            }
+            if (length == -1 && errno == EINTR) {
+                continue;
+            }
+            if (!participant.pending.empty()) {
+                LOG("[%s] %s\n", participant.name.c_str(), participant.pending.c_str());
+            }
+            close(participant.output);
+            participant.output = -1;
+            waitpid(participant.pid, &participant.status, 0);
+            participant.endNs = monotonicNs();
+            running--;
+
+            const bool failed = !WIFEXITED(participant.status) || WEXITSTATUS(participant.status) != 0;
+            if (failed && !stopping) {
+                LOG("Orchestrator: %s failed, stopping the others\n", participant.name.c_str());
+                stopping = true;
+                for (auto const& other : participants) {
+                    if (other.output >= 0) {
+                        kill(other.pid, SIGTERM);
+                    }
+                }
+            }
+        }
+    }
+
+    int result = 0;
+    for (auto const& participant : participants) {
+        const double seconds = (participant.endNs - participant.startNs) / 1e9;
+        if (WIFEXITED(participant.status)) {
+            LOG("Orchestrator: %s exited with %d after %.3f s\n", participant.name.c_str(),
+                WEXITSTATUS(participant.status), seconds);
+        } else {
+            LOG("Orchestrator: %s killed by signal %d after %.3f s\n", participant.name.c_str(),
+                WTERMSIG(participant.status), seconds);
+        }
+        if (!WIFEXITED(participant.status) || WEXITSTATUS(participant.status) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+int run(int argc, char *argv[]) {
     std::vector<Request> requests;
     // argv[1] must be used to specify client/server/ace mode
-    if (strcmp(argv[1], "s") && strcmp(argv[1], "c"))
+    if (argc < 3 || (strcmp(argv[1], "s") && strcmp(argv[1], "c") && strcmp(argv[1], "sim")
+        && strcmp(argv[1], "d") && strcmp(argv[1], "e") && strcmp(argv[1], "o")))
     {
         fprintf(stderr,
-            "The first parameter must be specifying if it's client (c) or server (s) mode?\n");
+            "The first parameter must be specifying if it's client (c), server (s), simulation (sim), daemon (d), experiment (e) or orchestrator (o) mode?\n");
         exit(-1);
     }
 
+    if (!strcmp(argv[1], "o")) {
+        return orchestrate(argc - 2, argv + 2);
+    }
+
+    if (!strcmp(argv[1], "e")) {
+        return experiment(argc - 2, argv + 2);
+    }
+    if (!strcmp(argv[1], "d")) {
+        requests.reserve(argc);
+        for (int i = 2; i < argc; i++) {
+            requests.emplace_back(argv[i]);
+        }
+        return runDaemon(requests);
+    }
+
+    // sim takes any number of requests and an optional gpu= model
+    if (!strcmp(argv[1], "sim")) {
+        SimGpu::Config config;
+        requests.reserve(argc);
+        for (int i = 2; i < argc; i++) {
+            if (!strncmp(argv[i], "gpu=", 4)) {
+                config = SimGpu::Config::parse(argv[i]);
+            } else {
+                requests.emplace_back(argv[i]);
+            }
+        }
+        return sim(requests, config);
+    }
+
     requests.emplace_back(argv[2]);
     gfx(requests, !strcmp(argv[1], "s"));
 
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    const int result = run(argc, argv);
+    // exit() paths are written out by the logger's destructor
+    Logger::instance().flush();
+    return result;
+}
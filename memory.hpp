@@ -0,0 +1,189 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include "VulkanTools.h"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+    Device memory allocated by the workloads, per owner and per heap, with
+    the peak of each. With VK_EXT_memory_budget every allocation is checked
+    against the budget the driver reports for its heap, which accounts for
+    other processes on the GPU too; without it against the heap size. An
+    allocation that would exceed it is logged before it is made, since
+    memory pressure skews preemption latency.
+*/
+class MemoryTracker {
+    struct Usage {
+        VkDeviceSize current = 0;
+        VkDeviceSize peak = 0;
+
+        void add(VkDeviceSize size) {
+            current += size;
+            peak = std::max(peak, current);
+        }
+    };
+
+    struct Owner {
+        std::string label;
+        Usage usage;
+        bool released = false;
+    };
+
+    struct Allocation {
+        unsigned owner;
+        uint32_t heap;
+        VkDeviceSize size;
+    };
+
+    VkPhysicalDevice m_physicalDevice;
+    VkPhysicalDeviceMemoryProperties m_properties;
+    bool m_budgetExtension;
+    mutable std::mutex m_mutex;
+    std::vector<Owner> m_owners;
+    std::vector<Usage> m_heaps;
+    std::map<VkDeviceMemory, Allocation> m_allocations;
+
+    // Budget and usage of every heap as the driver reports them, false without VK_EXT_memory_budget
+    bool queryBudget(VkPhysicalDeviceMemoryBudgetPropertiesEXT& budget) const {
+        if (!m_budgetExtension) {
+            return false;
+        }
+        budget = {};
+        budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 properties = {};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties.pNext = &budget;
+        vkGetPhysicalDeviceMemoryProperties2(m_physicalDevice, &properties);
+        return true;
+    }
+
+    static double mib(VkDeviceSize size) {
+        return size / (1024.0 * 1024.0);
+    }
+
+public:
+    MemoryTracker(VkPhysicalDevice physicalDevice, bool budgetExtension)
+        : m_physicalDevice(physicalDevice)
+        , m_budgetExtension(budgetExtension)
+    {
+        vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &m_properties);
+        m_heaps.resize(m_properties.memoryHeapCount);
+    }
+
+    MemoryTracker(const MemoryTracker&) = delete;
+    MemoryTracker& operator=(const MemoryTracker&) = delete;
+
+    // Returns the owner id for allocate(), e.g. one per workload
+    unsigned addOwner(std::string const& label) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_owners.push_back(Owner());
+        m_owners.back().label = label;
+        return m_owners.size() - 1;
+    }
+
+    // The owner is gone; anything it still holds is reported as leaked
+    void releaseOwner(unsigned owner) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Owner& o = m_owners[owner];
+        o.released = true;
+        if (o.usage.current) {
+            LOG_WARN("Memory: %s released with %.2f MiB still allocated\n", o.label.c_str(), mib(o.usage.current));
+        }
+    }
+
+    // vkAllocateMemory, recorded against owner
+    VkResult allocate(VkDevice device, VkMemoryAllocateInfo const& info, VkDeviceMemory* memory, unsigned owner) {
+        const uint32_t heap = m_properties.memoryTypes[info.memoryTypeIndex].heapIndex;
+        std::string label;
+        VkDeviceSize tracked;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            label = m_owners[owner].label;
+            tracked = m_heaps[heap].current;
+        }
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget;
+        if (queryBudget(budget)) {
+            if (budget.heapUsage[heap] + info.allocationSize > budget.heapBudget[heap]) {
+                LOG_WARN("Memory: %.2f MiB for %s exceeds the budget of heap %u, %.2f of %.2f MiB in use\n",
+                    mib(info.allocationSize), label.c_str(), heap, mib(budget.heapUsage[heap]), mib(budget.heapBudget[heap]));
+            }
+        } else if (tracked + info.allocationSize > m_properties.memoryHeaps[heap].size) {
+            LOG_WARN("Memory: %.2f MiB for %s exceeds heap %u, %.2f of %.2f MiB tracked\n",
+                mib(info.allocationSize), label.c_str(), heap, mib(tracked), mib(m_properties.memoryHeaps[heap].size));
+        }
+
+        const VkResult result = vkAllocateMemory(device, &info, nullptr, memory);
+        if (result == VK_SUCCESS) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_allocations[*memory] = { owner, heap, info.allocationSize };
+            m_owners[owner].usage.add(info.allocationSize);
+            m_heaps[heap].add(info.allocationSize);
+        }
+        return result;
+    }
+
+    // vkFreeMemory; VK_NULL_HANDLE is ignored like there
+    void free(VkDevice device, VkDeviceMemory memory) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_allocations.find(memory);
+            if (it != m_allocations.end()) {
+                m_owners[it->second.owner].usage.current -= it->second.size;
+                m_heaps[it->second.heap].current -= it->second.size;
+                m_allocations.erase(it);
+            }
+        }
+        vkFreeMemory(device, memory, nullptr);
+    }
+
+    // Every heap, every live owner, and the released owners summarised by label
+    void report() const {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget;
+        const bool hasBudget = queryBudget(budget);
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        LOG_INFO("Memory footprint:\n");
+        for (uint32_t heap = 0; heap < m_heaps.size(); heap++) {
+            const VkMemoryHeap& properties = m_properties.memoryHeaps[heap];
+            const char* kind = (properties.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "device local" : "host";
+            if (hasBudget) {
+                LOG_INFO("  heap %u (%s, %.0f MiB): tracked %.2f MiB, peak %.2f MiB; process usage %.2f MiB, budget %.2f MiB\n",
+                    heap, kind, mib(properties.size), mib(m_heaps[heap].current), mib(m_heaps[heap].peak),
+                    mib(budget.heapUsage[heap]), mib(budget.heapBudget[heap]));
+            } else {
+                LOG_INFO("  heap %u (%s, %.0f MiB): tracked %.2f MiB, peak %.2f MiB\n",
+                    heap, kind, mib(properties.size), mib(m_heaps[heap].current), mib(m_heaps[heap].peak));
+            }
+        }
+
+        struct Released {
+            unsigned count = 0;
+            VkDeviceSize peak = 0;
+        };
+        std::map<std::string, Released> released;
+        for (auto const& owner : m_owners) {
+            if (owner.released) {
+                Released& r = released[owner.label];
+                r.count++;
+                r.peak = std::max(r.peak, owner.usage.peak);
+            } else {
+                LOG_INFO("  %s: %.2f MiB, peak %.2f MiB\n", owner.label.c_str(), mib(owner.usage.current), mib(owner.usage.peak));
+            }
+        }
+        for (auto const& item : released) {
+            LOG_INFO("  %s: %u released, peak %.2f MiB each at most\n", item.first.c_str(), item.second.count, mib(item.second.peak));
+        }
+    }
+};
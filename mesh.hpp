@@ -0,0 +1,172 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+    Procedural indexed triangle meshes in [-1, 1]. Every generator returns
+    exactly the requested number of triangles, wound so that the faces
+    towards the camera pass GraphicsWork's back face culling.
+*/
+struct Mesh {
+    enum class Type {
+        Triangle,   // the single triangle GraphicsWork always drew
+        Quad,       // two triangles covering all of [-1, 1], drawn untransformed to fill the target
+        Grid,       // flat grid facing the camera, neighbouring triangles share vertices
+        Sphere,     // UV sphere, the far half is culled
+        Soup        // small triangles along a random walk
+    };
+
+    struct Vertex {
+        float position[3];
+        float color[3];
+    };
+
+    struct Spec {
+        Type type = Type::Triangle;
+        unsigned triangles = 1;
+        unsigned vertices = 0;      // soup only: size of the shared vertex pool, 0 for 3 per triangle
+        uint64_t seed = 1;
+    };
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+
+    uint32_t triangleCount() const { return indices.size() / 3; }
+
+    static bool parseType(const std::string& str, Type& type) {
+        static const std::map<std::string, Type> types = {
+            {"triangle", Type::Triangle},
+            {"quad", Type::Quad},
+            {"grid", Type::Grid},
+            {"sphere", Type::Sphere},
+            {"soup", Type::Soup}
+        };
+        auto it = types.find(str);
+        if (it == types.end()) {
+            return false;
+        }
+        type = it->second;
+        return true;
+    }
+
+    static Mesh generate(Spec const& spec) {
+        switch (spec.type) {
+            case Type::Quad: return grid(2);
+            case Type::Grid: return grid(spec.triangles);
+            case Type::Sphere: return sphere(spec.triangles);
+            case Type::Soup: return soup(spec.triangles, spec.vertices, spec.seed);
+            case Type::Triangle: break;
+        }
+        return triangle();
+    }
+
+    static Mesh triangle() {
+        Mesh mesh;
+        mesh.vertices = {
+            { {  1.0f,  1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f } },
+            { { -1.0f,  1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
+            { {  0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } }
+        };
+        mesh.indices = { 0, 1, 2 };
+        return mesh;
+    }
+
+    // cols x rows quads, trimmed to the requested triangle count
+    static Mesh grid(unsigned triangles) {
+        Mesh mesh;
+        triangles = std::max(triangles, 1u);
+        const unsigned cols = std::ceil(std::sqrt(triangles / 2.0));
+        const unsigned rows = (triangles + 2 * cols - 1) / (2 * cols);
+
+        for (unsigned r = 0; r <= rows; r++) {
+            for (unsigned c = 0; c <= cols; c++) {
+                const float x = 2.0f * c / cols - 1.0f;
+                const float y = 2.0f * r / rows - 1.0f;
+                mesh.vertices.push_back({ { x, y, 0.0f }, { 0.5f + 0.5f * x, 0.5f + 0.5f * y, 0.5f } });
+            }
+        }
+        for (unsigned r = 0; r < rows; r++) {
+            for (unsigned c = 0; c < cols; c++) {
+                const uint32_t a = r * (cols + 1) + c;
+                const uint32_t d = a + cols + 1;
+                mesh.indices.insert(mesh.indices.end(), { a, a + 1, d, a + 1, d + 1, d });
+            }
+        }
+        mesh.indices.resize(3 * triangles);
+        return mesh;
+    }
+
+    // stacks x 2*stacks quads from pole to pole, trimmed to the requested triangle count
+    static Mesh sphere(unsigned triangles) {
+        Mesh mesh;
+        triangles = std::max(triangles, 1u);
+        const unsigned stacks = std::max(2.0, std::ceil(std::sqrt(triangles / 4.0)));
+        const unsigned slices = 2 * stacks;
+        const float pi = 3.14159265358979f;
+
+        for (unsigned i = 0; i <= stacks; i++) {
+            const float theta = pi * i / stacks;
+            for (unsigned j = 0; j <= slices; j++) {
+                const float phi = 2.0f * pi * j / slices;
+                const float x = std::sin(theta) * std::cos(phi);
+                const float y = std::cos(theta);
+                const float z = std::sin(theta) * std::sin(phi);
+                mesh.vertices.push_back({ { x, y, z }, { 0.5f + 0.5f * x, 0.5f + 0.5f * y, 0.5f + 0.5f * z } });
+            }
+        }
+        for (unsigned i = 0; i < stacks; i++) {
+            for (unsigned j = 0; j < slices; j++) {
+                const uint32_t a = i * (slices + 1) + j;
+                const uint32_t b = a + slices + 1;
+                mesh.indices.insert(mesh.indices.end(), { a, b + 1, b, a, a + 1, b + 1 });
+            }
+        }
+        mesh.indices.resize(3 * triangles);
+        return mesh;
+    }
+
+    // With a pool smaller than 3 per triangle, triangles start at random pool entries and share vertices
+    static Mesh soup(unsigned triangles, unsigned poolSize, uint64_t seed) {
+        Mesh mesh;
+        triangles = std::max(triangles, 1u);
+        const bool shared = poolSize != 0 && poolSize < 3 * triangles;
+        const unsigned count = shared ? std::max(poolSize, 3u) : 3 * triangles;
+        std::mt19937_64 rng(seed);
+        std::uniform_real_distribution<float> step(-0.05f, 0.05f);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        // Consecutive vertices are close, so a triangle of neighbours stays small
+        float p[3] = { 0.0f, 0.0f, 0.0f };
+        for (unsigned i = 0; i < count; i++) {
+            for (auto& c : p) {
+                c += step(rng);
+                c = c > 1.0f ? 2.0f - c : (c < -1.0f ? -2.0f - c : c);
+            }
+            mesh.vertices.push_back({ { p[0], p[1], p[2] }, { unit(rng), unit(rng), unit(rng) } });
+        }
+        for (unsigned t = 0; t < triangles; t++) {
+            const uint32_t base = shared ? rng() % (count - 2) : 3 * t;
+            uint32_t tri[3] = { base, base + 1, base + 2 };
+            const float* a = mesh.vertices[tri[0]].position;
+            const float* b = mesh.vertices[tri[1]].position;
+            const float* c = mesh.vertices[tri[2]].position;
+            if ((b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]) < 0.0f) {
+                std::swap(tri[1], tri[2]);
+            }
+            mesh.indices.insert(mesh.indices.end(), { tri[0], tri[1], tri[2] });
+        }
+        return mesh;
+    }
+};
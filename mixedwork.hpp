@@ -0,0 +1,318 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+#include "base.hpp"
+#include "computework.hpp"
+#include "graphicwork.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+    Options of a MixedWork. Every round is a render pass of drawsPerPass draws followed by
+    dispatchesPerPass dispatches; barrier is what separates the two at every transition.
+    graphics and compute configure the render target, mesh and storage buffer as for
+    GraphicsWork and ComputeWork; frames and statistics are taken from graphics.
+*/
+struct MixedConfig {
+    enum class Barrier {
+        None,       // no dependency, the GPU may overlap the render pass and the dispatches
+        Stage,      // color and depth output before compute, compute before vertex and fragment shading
+        Full        // all commands before all commands, the pipeline drains at every transition
+    };
+
+    GraphicsConfig graphics;
+    ComputeConfig compute;
+    uint32_t drawsPerPass = 1;
+    uint32_t dispatchesPerPass = 1;
+    Barrier barrier = Barrier::Stage;
+
+    // none, stage or full
+    static bool parseBarrier(const std::string& str, Barrier& barrier) {
+        if (str == "none") {
+            barrier = Barrier::None;
+        } else if (str == "stage") {
+            barrier = Barrier::Stage;
+        } else if (str == "full") {
+            barrier = Barrier::Full;
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
+
+/*
+    Render passes and dispatches alternating in one command buffer on a graphics queue, as a
+    tenant that mixes both records them. The pipelines, buffers and render targets are those of
+    a GraphicsWork and a ComputeWork built record-only on the same queue, without command
+    buffers or query pools of their own. Every frame renders into a target of its own, but all
+    frames increment and read back the one storage buffer of the ComputeWork: submissions of
+    different frames are kept apart only by the barrier recordSetup puts at the start of each.
+
+    A timestamp is written at every transition between a render pass and the dispatches, so the
+    progress curve has a point per segment. A segment that took much longer than the median of
+    its kind is where the queue was switched out; the summary in waitIdle names the transition.
+*/
+class MixedWork : public Workload {
+    VkDevice device;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    double timestampPeriod;
+    std::unique_ptr<GraphicsWork> graphics;
+    std::unique_ptr<ComputeWork> compute;
+    FrameRing frames;
+    MixedConfig::Barrier barrier;
+    unsigned rounds;
+    unsigned drawsPerPass, dispatchesPerPass;
+    std::vector<unsigned> markCommands;     // commands completed at every transition
+    unsigned submissions = 0;
+
+    unsigned commandCount() const {
+        return rounds * (drawsPerPass + dispatchesPerPass);
+    }
+
+    // From the render pass to the dispatches when toCompute, else back
+    void recordTransition(VkCommandBuffer commandBuffer, bool toCompute) {
+        VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+        VkPipelineStageFlags srcStage, dstStage;
+        switch (barrier) {
+        case MixedConfig::Barrier::None:
+            return;
+        case MixedConfig::Barrier::Stage:
+            if (toCompute) {
+                srcStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+                dstStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                memoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+                memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            } else {
+                srcStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                dstStage = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+                memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            }
+            break;
+        case MixedConfig::Barrier::Full:
+            srcStage = dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            memoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+            break;
+        }
+        vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    void recordCommands(unsigned frame) {
+        const VkCommandBuffer commandBuffer = frames[frame].commandBuffer;
+        const VkQueryPool queryPool = frames[frame].queryPool;
+        const VkQueryPool statisticsPool = frames[frame].statisticsPool;
+
+        VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+        VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+        if (!frames.hostQueryReset()) {
+            vkCmdResetQueryPool(commandBuffer, queryPool, 0, frames.queries());
+            if (statisticsPool != VK_NULL_HANDLE) {
+                vkCmdResetQueryPool(commandBuffer, statisticsPool, 0, 1);
+            }
+        }
+        compute->recordSetup(commandBuffer);
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        if (statisticsPool != VK_NULL_HANDLE) {
+            vkCmdBeginQuery(commandBuffer, statisticsPool, 0, 0);
+        }
+        uint32_t firstTriangle = 0;
+        unsigned segment = 0;
+        auto mark = [&]() {
+            if (segment < markCommands.size()) {
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 + segment);
+            }
+            segment++;
+        };
+        for (unsigned round = 0; round < rounds; round++) {
+            if (round > 0) {
+                recordTransition(commandBuffer, false);
+            }
+            graphics->beginRenderPass(commandBuffer, frame);
+            for (unsigned i = 0; i < drawsPerPass; i++) {
+                graphics->recordDraw(commandBuffer, graphics->randomPosition(), firstTriangle);
+            }
+            vkCmdEndRenderPass(commandBuffer);
+            mark();
+
+            recordTransition(commandBuffer, true);
+            compute->bindPipeline(commandBuffer);
+            for (unsigned i = 0; i < dispatchesPerPass; i++) {
+                compute->recordDispatch(commandBuffer, round == 0 && i == 0);
+            }
+            mark();
+        }
+        if (statisticsPool != VK_NULL_HANDLE) {
+            vkCmdEndQuery(commandBuffer, statisticsPool, 0);
+        }
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+
+        compute->recordReadback(commandBuffer);
+        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+    }
+
+    // Median and maximum segment time of each kind in the last submission, and the segment furthest
+    // beyond the median of its kind
+    void reportSegments() {
+        const ProgressCurve curve = queryProgress(frames.last(), timestampPeriod);
+        if (curve.points.size() != markCommands.size() + 2) {
+            LOG("Mixed: transition timestamps not available\n");
+            return;
+        }
+        std::vector<uint64_t> ns[2];            // render passes, dispatches
+        for (size_t i = 1; i < curve.points.size(); i++) {
+            ns[(i - 1) % 2].push_back(curve.points[i].ns - curve.points[i - 1].ns);
+        }
+        const char* kinds[2] = { "render pass", "dispatches" };
+        uint64_t median[2];
+        for (int kind = 0; kind < 2; kind++) {
+            std::vector<uint64_t> sorted = ns[kind];
+            std::sort(sorted.begin(), sorted.end());
+            median[kind] = sorted[sorted.size() / 2];
+            LOG("Mixed: %zu %s segment(s), median %lu ns, max %lu ns\n", sorted.size(), kinds[kind],
+                (unsigned long)median[kind], (unsigned long)sorted.back());
+        }
+        size_t worst = 0;
+        uint64_t excess = 0;
+        for (size_t i = 0; i < markCommands.size() + 1; i++) {
+            const uint64_t segmentNs = ns[i % 2][i / 2];
+            if (segmentNs > median[i % 2] && segmentNs - median[i % 2] > excess) {
+                excess = segmentNs - median[i % 2];
+                worst = i;
+            }
+        }
+        if (excess) {
+            LOG("Mixed: largest overrun %lu ns in %s segment %zu of round %zu, after the %s\n", (unsigned long)excess,
+                kinds[worst % 2], worst, worst / 2, worst == 0 ? "start" : kinds[(worst + 1) % 2]);
+        }
+    }
+
+public:
+    // Whether the queue can run both parts of config, else why not
+    static bool supports(Base& base, QueueInfo const& queueInfo, MixedConfig const& config, std::string* why) {
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(base.GetPhysicalDevice(), &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(base.GetPhysicalDevice(), &familyCount, families.data());
+        if (!(families[queueInfo.familyIndex].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+            if (why) {
+                *why = "Queue family " + std::to_string(queueInfo.familyIndex)
+                    + " has no compute support, render passes and dispatches cannot be mixed";
+            }
+            return false;
+        }
+        return GraphicsWork::supports(base, config.graphics, why) && ComputeWork::supports(base, config.compute, why);
+    }
+
+    // rounds of a render pass and dispatches per submission
+    MixedWork(Base& base, QueueInfo queueInfo, unsigned rounds, unsigned triangleCount,
+        MixedConfig const& config, ThreadPool* pool = nullptr)
+        : barrier(config.barrier)
+        , rounds(std::max(rounds, 1u))
+        , drawsPerPass(std::max(config.drawsPerPass, 1u))
+        , dispatchesPerPass(std::max(config.dispatchesPerPass, 1u))
+    {
+        device = base.GetDevice();
+        queue = queueInfo.queue;
+        timestampPeriod = base.GetPhysicalDeviceProperties().limits.timestampPeriod;
+
+        std::string why;
+        if (!supports(base, queueInfo, config, &why)) {
+            LOG("%s\n", why.c_str());
+            exit(-1);
+        }
+
+        // The parts only record into the command buffers here, and only count as a pass each
+        GraphicsConfig graphicsConfig = config.graphics;
+        graphicsConfig.progressInterval = 0;
+        graphicsConfig.statistics = false;
+        graphicsConfig.recordOnly = true;
+        ComputeConfig computeConfig = config.compute;
+        computeConfig.progressInterval = 0;
+        computeConfig.statistics = false;
+        computeConfig.recordOnly = true;
+        {
+            TaskGroup tasks(pool);
+            tasks.run([&]() { graphics.reset(new GraphicsWork(base, queueInfo, drawsPerPass, triangleCount, graphicsConfig, pool)); });
+            tasks.run([&]() { compute.reset(new ComputeWork(base, queueInfo, dispatchesPerPass, computeConfig, pool)); });
+        }
+
+        VkCommandPoolCreateInfo cmdPoolInfo = {};
+        cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolInfo.queueFamilyIndex = queueInfo.familyIndex;
+        cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
+        for (unsigned round = 0; round < this->rounds; round++) {
+            markCommands.push_back(round * (drawsPerPass + dispatchesPerPass) + drawsPerPass);
+            markCommands.push_back((round + 1) * (drawsPerPass + dispatchesPerPass));
+        }
+        markCommands.pop_back();
+        if (config.graphics.statistics && !base.HasPipelineStatistics()) {
+            LOG("Pipeline statistics queries are not supported, statistics are not collected\n");
+        }
+        const VkQueryPipelineStatisticFlags statistics = config.graphics.statistics && base.HasPipelineStatistics()
+            ? PipelineStatistics::graphicsFlags() | PipelineStatistics::computeFlags() : 0;
+        frames.create(device, commandPool, config.graphics.frames, 2 + static_cast<uint32_t>(markCommands.size()),
+            base.GetHostQueryReset(), statistics);
+
+        for (unsigned frame = 0; frame < frames.depth(); frame++) {
+            recordCommands(frame);
+        }
+    }
+
+    virtual Submission prepareSubmit() override {
+        const unsigned frame = frames.acquire();
+        submissions++;
+
+        Submission submission = {};
+        submission.queue = queue;
+        submission.commandBuffer = frames[frame].commandBuffer;
+        submission.fence = frames[frame].fence;
+        return submission;
+    }
+
+    virtual unsigned depth() const override { return frames.depth(); }
+    virtual unsigned lastFrame() const override { return frames.last(); }
+
+    virtual void queryTimestamp(unsigned frame, uint64_t time_stamp[], int count) override {
+        VK_CHECK_RESULT(vkGetQueryPoolResults(device, frames[frame].queryPool, 0, count,
+            sizeof(uint64_t)*count, time_stamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+    }
+
+    // A point at every transition, commands counting draws and dispatches alike
+    virtual ProgressCurve queryProgress(unsigned frame, double timestampPeriod) override {
+        return ProgressCurve::collect(device, frames[frame].queryPool, markCommands, commandCount(), timestampPeriod);
+    }
+
+    virtual PipelineStatistics queryStatistics(unsigned frame) override {
+        if (!frames.statistics()) {
+            return PipelineStatistics();
+        }
+        return PipelineStatistics::collect(device, frames[frame].statisticsPool, frames.statistics());
+    }
+
+    virtual void waitIdle() override {
+        frames.wait();
+        reportSegments();
+        compute->verify(submissions * rounds * dispatchesPerPass);
+        graphics->saveImage(frames.last());
+    }
+
+    ~MixedWork() {
+        vkDestroyCommandPool(device, commandPool, nullptr);
+    }
+};
@@ -0,0 +1,97 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include "VulkanTools.h"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+    Pipeline statistics of one submission: what its draws or dispatches
+    amounted to on this device, in shader invocations and primitives. Printed
+    per command as well, so latencies measured with different devices or
+    request options can be compared at equal work.
+*/
+class PipelineStatistics {
+    struct Counter {
+        VkQueryPipelineStatisticFlagBits bit;
+        const char* name;
+    };
+
+    // In the order the results of a query are written, lowest bit first
+    static std::vector<Counter> const& counters() {
+        static const std::vector<Counter> all = {
+            { VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT, "ia vertices" },
+            { VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT, "ia primitives" },
+            { VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT, "vs invocations" },
+            { VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT, "clipping invocations" },
+            { VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT, "clipping primitives" },
+            { VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT, "fs invocations" },
+            { VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT, "cs invocations" }
+        };
+        return all;
+    }
+
+public:
+    static VkQueryPipelineStatisticFlags graphicsFlags() {
+        return VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT | VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
+            | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT
+            | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    }
+
+    static VkQueryPipelineStatisticFlags computeFlags() {
+        return VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+    }
+
+    std::vector<std::pair<const char*, uint64_t>> values;
+    bool available = false;         // false while the submission is still running
+
+    // Reads the statistics query of queryPool without waiting
+    static PipelineStatistics collect(VkDevice device, VkQueryPool queryPool, VkQueryPipelineStatisticFlags flags) {
+        std::vector<Counter> enabled;
+        for (auto const& counter : counters()) {
+            if (flags & counter.bit) {
+                enabled.push_back(counter);
+            }
+        }
+        std::vector<uint64_t> results(enabled.size() + 1);
+        const VkResult result = vkGetQueryPoolResults(device, queryPool, 0, 1, results.size() * sizeof(uint64_t),
+            results.data(), results.size() * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (result != VK_NOT_READY) {
+            VK_CHECK_RESULT(result);
+        }
+
+        PipelineStatistics statistics;
+        statistics.available = results.back() != 0;
+        for (size_t i = 0; i < enabled.size(); i++) {
+            statistics.values.push_back({ enabled[i].name, results[i] });
+        }
+        return statistics;
+    }
+
+    // Totals and per command; gpuNs is the execution time of the submission, 0 when not known
+    void print(const char* label, unsigned commandCount, uint64_t gpuNs) const {
+        if (values.empty()) {
+            LOG_INFO("%s: no pipeline statistics\n", label);
+            return;
+        }
+        if (!available) {
+            LOG_INFO("%s: statistics not available yet\n", label);
+            return;
+        }
+        std::string line;
+        for (auto const& value : values) {
+            line += std::string(line.empty() ? " " : ", ") + value.first + " " + std::to_string(value.second)
+                + " (" + std::to_string(value.second / std::max(commandCount, 1u)) + "/command)";
+        }
+        LOG_INFO("%s: %u commands in %lu ns,%s\n", label, commandCount, gpuNs, line.c_str());
+    }
+};
@@ -0,0 +1,158 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include "VulkanTools.h"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+    Progress marks of a command buffer: a BOTTOM_OF_PIPE timestamp after every
+    interval draws or dispatches, so it lands once those commands completed.
+    Queries 0 and 1 of a frame keep the timestamps before and after all of the
+    commands; the marks follow from query 2. The last command has no mark of
+    its own, query 1 covers it.
+*/
+struct ProgressMarks {
+    unsigned interval = 0;          // commands between marks, 0 for none
+    unsigned commandCount = 0;
+
+    uint32_t marks() const {
+        return interval && commandCount ? (commandCount - 1) / interval : 0;
+    }
+
+    // Timestamp queries a frame needs
+    uint32_t queries() const {
+        return 2 + marks();
+    }
+
+    // Called after recording command index, writes its mark if it has one
+    void write(VkCommandBuffer commandBuffer, VkQueryPool queryPool, unsigned command) const {
+        const unsigned done = command + 1;
+        if (interval && done % interval == 0 && done < commandCount) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1 + done / interval);
+        }
+    }
+};
+
+/*
+    Commands completed over GPU time for one submission, read from its progress
+    marks. Collection never waits: marks the GPU has not written yet are left
+    out and counted, so a submission can be sampled while it still runs.
+
+    The commands of a command buffer take about the same time each, so a step
+    of the curve that is much longer than its commands at the median rate is
+    time the queue did not run, e.g. switched out for higher priority work.
+*/
+class ProgressCurve {
+public:
+    struct Point {
+        unsigned commands;      // completed
+        uint64_t ns;            // since the start of the submission
+    };
+
+    struct Gap {
+        unsigned afterCommands = 0;
+        uint64_t atNs = 0;          // since the start of the submission
+        uint64_t ns = 0;            // beyond the median rate
+        double commandNs = 0;       // median per command
+    };
+
+    uint64_t startNs = 0;           // GPU time of the start, comparable across queues of the device
+    std::vector<Point> points;
+    unsigned missing = 0;           // marks not available yet
+
+    // Reads the queries of marks from queryPool with their availability
+    static ProgressCurve collect(VkDevice device, VkQueryPool queryPool, ProgressMarks const& marks, double timestampPeriod) {
+        std::vector<unsigned> markCommands;
+        for (uint32_t mark = 1; mark <= marks.marks(); mark++) {
+            markCommands.push_back(mark * marks.interval);
+        }
+        return collect(device, queryPool, markCommands, marks.commandCount, timestampPeriod);
+    }
+
+    // Marks at any positions: query 2 + i is written once markCommands[i] of the commandCount commands completed
+    static ProgressCurve collect(VkDevice device, VkQueryPool queryPool, std::vector<unsigned> const& markCommands,
+        unsigned commandCount, double timestampPeriod) {
+        const uint32_t queries = 2 + static_cast<uint32_t>(markCommands.size());
+        std::vector<uint64_t> results(queries * 2);
+        const VkResult result = vkGetQueryPoolResults(device, queryPool, 0, queries, results.size() * sizeof(uint64_t),
+            results.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (result != VK_NOT_READY) {
+            VK_CHECK_RESULT(result);
+        }
+
+        ProgressCurve curve;
+        auto available = [&](uint32_t query) { return results[query * 2 + 1] != 0; };
+        auto value = [&](uint32_t query) { return results[query * 2]; };
+        if (!available(0)) {
+            curve.missing = queries - 2;
+            return curve;
+        }
+        curve.startNs = static_cast<uint64_t>(value(0) * timestampPeriod);
+        auto add = [&](uint32_t query, unsigned commands) {
+            if (available(query)) {
+                curve.points.push_back({ commands, static_cast<uint64_t>((value(query) - value(0)) * timestampPeriod) });
+            } else {
+                curve.missing++;
+            }
+        };
+        curve.points.push_back({ 0, 0 });
+        for (uint32_t mark = 0; mark < markCommands.size(); mark++) {
+            add(2 + mark, markCommands[mark]);
+        }
+        // The end is not a mark, without it the submission is still running
+        if (available(1)) {
+            add(1, commandCount);
+        }
+        return curve;
+    }
+
+    // The step furthest beyond the median time per command
+    Gap largestGap() const {
+        Gap gap;
+        std::vector<double> rates;
+        for (size_t i = 1; i < points.size(); i++) {
+            rates.push_back(double(points[i].ns - points[i - 1].ns) / (points[i].commands - points[i - 1].commands));
+        }
+        if (rates.empty()) {
+            return gap;
+        }
+        std::nth_element(rates.begin(), rates.begin() + rates.size() / 2, rates.end());
+        gap.commandNs = rates[rates.size() / 2];
+        for (size_t i = 1; i < points.size(); i++) {
+            const double expected = gap.commandNs * (points[i].commands - points[i - 1].commands);
+            const double excess = double(points[i].ns - points[i - 1].ns) - expected;
+            if (excess > double(gap.ns)) {
+                gap.afterCommands = points[i - 1].commands;
+                gap.atNs = points[i - 1].ns;
+                gap.ns = static_cast<uint64_t>(excess);
+            }
+        }
+        return gap;
+    }
+
+    void print(const char* label) const {
+        LOG_INFO("%s: start %lu ns\n", label, startNs);
+        // A few points per line, log records are limited in size
+        std::string curve;
+        for (size_t i = 0; i < points.size(); i++) {
+            curve += " " + std::to_string(points[i].commands) + ":" + std::to_string(points[i].ns);
+            if ((i + 1) % 16 == 0 || i + 1 == points.size()) {
+                LOG_INFO("%s: commands:ns%s\n", label, curve.c_str());
+                curve.clear();
+            }
+        }
+        const Gap gap = largestGap();
+        LOG_INFO("%s: largest gap %lu ns after %u commands at +%lu ns, median %.0f ns per command, %u mark(s) not available\n",
+            label, gap.ns, gap.afterCommands, gap.atNs, gap.commandNs, missing);
+    }
+};
@@ -0,0 +1,332 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+    Framed messages between the server, the client, the daemon and experiment
+    clients. Every frame is a 12 byte header (magic, protocol version, message
+    type, payload length; all little endian) followed by the payload. A
+    payload is a sequence of fixed-size integers and length-prefixed strings.
+    New fields are only ever appended: readers ignore trailing fields they do
+    not know, read missing ones as 0, and skip message types they do not
+    know, so builds of different versions still talk. PROTOCOL_MIN_VERSION is
+    raised only for changes older builds cannot follow.
+*/
+#define PROTOCOL_MAGIC 0x504d4b56u      // "VKMP"
+#define PROTOCOL_VERSION 2
+#define PROTOCOL_MIN_VERSION 2       // 2: the server waits for Done before the solo baselines
+
+enum class MessageType : uint16_t {
+    Hello = 1,      // version, iterations per run, role
+    Start,          // CLOCK_MONOTONIC ns both sides count their delays from
+    Sample,         // one iteration: index, launch, completion, queue wait, largest launch error of its submissions
+    Summary,        // end of a side's results
+    Error,          // text; the sender gives up
+    Release,        // the server is done with its solo baseline, the client may run its own
+    Trial,          // search: low priority commands (0 ends the search), absolute launch time
+    Experiment,     // daemon: request spec
+    Done            // the client finished its contended runs, all its samples were sent before
+};
+
+class MessageWriter {
+    std::vector<uint8_t> m_data;
+
+public:
+    MessageWriter& u32(uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            m_data.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+        return *this;
+    }
+
+    MessageWriter& u64(uint64_t value) {
+        for (int i = 0; i < 8; i++) {
+            m_data.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+        return *this;
+    }
+
+    MessageWriter& i64(int64_t value) {
+        return u64(static_cast<uint64_t>(value));
+    }
+
+    MessageWriter& str(std::string const& value) {
+        u32(value.size());
+        m_data.insert(m_data.end(), value.begin(), value.end());
+        return *this;
+    }
+
+    std::vector<uint8_t> const& data() const { return m_data; }
+};
+
+struct Message {
+    MessageType type;
+    uint16_t version;
+    std::vector<uint8_t> payload;
+};
+
+// Reads the fields of a payload in order; fields past its end read as 0 or empty
+class MessageReader {
+    std::vector<uint8_t> const& m_data;
+    size_t m_offset;
+
+    uint64_t read(int bytes) {
+        uint64_t value = 0;
+        if (m_offset + bytes > m_data.size()) {
+            m_offset = m_data.size();
+            return 0;
+        }
+        for (int i = 0; i < bytes; i++) {
+            value |= static_cast<uint64_t>(m_data[m_offset + i]) << (8 * i);
+        }
+        m_offset += bytes;
+        return value;
+    }
+
+public:
+    explicit MessageReader(Message const& message) : m_data(message.payload), m_offset(0) {}
+
+    uint32_t u32() { return static_cast<uint32_t>(read(4)); }
+    uint64_t u64() { return read(8); }
+    int64_t i64() { return static_cast<int64_t>(read(8)); }
+
+    std::string str() {
+        const size_t size = u32();
+        if (m_offset + size > m_data.size()) {
+            m_offset = m_data.size();
+            return std::string();
+        }
+        std::string value(m_data.begin() + m_offset, m_data.begin() + m_offset + size);
+        m_offset += size;
+        return value;
+    }
+};
+
+/*
+    A stream socket exchanging frames with non-blocking I/O. send() queues the
+    frame and writes what the socket takes without waiting; the rest goes out
+    on later calls. tryReceive() never blocks, so results can be taken in
+    between timed iterations. Owns the socket.
+*/
+class Connection {
+    static const size_t HEADER_SIZE = 12;
+    static const size_t MAX_PAYLOAD = 1 << 20;
+
+    int m_fd;
+    std::vector<uint8_t> m_in;
+    std::vector<uint8_t> m_out;
+    bool m_open;
+
+    static uint32_t load(const uint8_t* p, int bytes) {
+        uint32_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value |= static_cast<uint32_t>(p[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    // Writes as much of m_out as the socket takes
+    void write() {
+        while (m_open && !m_out.empty()) {
+            const ssize_t sent = ::send(m_fd, m_out.data(), m_out.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    m_open = false;
+                }
+                return;
+            }
+            m_out.erase(m_out.begin(), m_out.begin() + sent);
+        }
+    }
+
+    // Reads whatever has arrived
+    void read() {
+        uint8_t buffer[4096];
+        while (m_open) {
+            const ssize_t received = ::recv(m_fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                m_in.insert(m_in.end(), buffer, buffer + received);
+                continue;
+            }
+            if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                m_open = false;
+            }
+            return;
+        }
+    }
+
+    // Takes one complete frame off m_in
+    bool parse(Message& message) {
+        if (m_in.size() >= HEADER_SIZE) {
+            const uint32_t length = load(&m_in[8], 4);
+            if (load(&m_in[0], 4) != PROTOCOL_MAGIC || length > MAX_PAYLOAD) {
+                LOG("Protocol: bad frame, closing the connection\n");
+                m_in.clear();
+                m_open = false;
+                return false;
+            }
+            if (m_in.size() < HEADER_SIZE + length) {
+                return false;
+            }
+            message.version = load(&m_in[4], 2);
+            message.type = static_cast<MessageType>(load(&m_in[6], 2));
+            message.payload.assign(m_in.begin() + HEADER_SIZE, m_in.begin() + HEADER_SIZE + length);
+            m_in.erase(m_in.begin(), m_in.begin() + HEADER_SIZE + length);
+            return true;
+        }
+        return false;
+    }
+
+public:
+    explicit Connection(int fd) : m_fd(fd), m_open(fd >= 0) {
+        if (m_open) {
+            fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+
+    ~Connection() {
+        flush();
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    bool isOpen() const { return m_open; }
+
+    void send(MessageType type, MessageWriter const& writer = MessageWriter()) {
+        std::vector<uint8_t> const& payload = writer.data();
+        const uint32_t header[3] = { PROTOCOL_MAGIC, PROTOCOL_VERSION | (static_cast<uint32_t>(type) << 16),
+            static_cast<uint32_t>(payload.size()) };
+        for (uint32_t word : header) {
+            for (int i = 0; i < 4; i++) {
+                m_out.push_back(static_cast<uint8_t>(word >> (8 * i)));
+            }
+        }
+        m_out.insert(m_out.end(), payload.begin(), payload.end());
+        write();
+    }
+
+    // Waits until everything queued is written or the connection is gone
+    void flush() {
+        write();
+        while (m_open && !m_out.empty()) {
+            struct pollfd pfd = { m_fd, POLLOUT, 0 };
+            poll(&pfd, 1, -1);
+            write();
+        }
+    }
+
+    // A message if a complete one has arrived, without waiting
+    bool tryReceive(Message& message) {
+        write();
+        if (parse(message)) {
+            return true;
+        }
+        read();
+        return parse(message);
+    }
+
+    // Waits for the next message; false once the connection is closed and nothing is left
+    bool receive(Message& message) {
+        while (!tryReceive(message)) {
+            if (!m_open) {
+                return false;
+            }
+            struct pollfd pfd = { m_fd, static_cast<short>(POLLIN | (m_out.empty() ? 0 : POLLOUT)), 0 };
+            poll(&pfd, 1, -1);
+        }
+        return true;
+    }
+
+    // Waits for a message of the given type; an Error from the peer is logged and ends the wait.
+    // Messages of other types arriving first are passed to other, or dropped without it.
+    template <typename Handler>
+    bool receive(MessageType type, Message& message, Handler other) {
+        while (receive(message)) {
+            if (message.type == type) {
+                return true;
+            }
+            if (message.type == MessageType::Error) {
+                MessageReader reader(message);
+                LOG("Peer error: %s\n", reader.str().c_str());
+                return false;
+            }
+            other(message);
+        }
+        return false;
+    }
+
+    bool receive(MessageType type, Message& message) {
+        return receive(type, message, [](Message const&) {});
+    }
+};
+
+// One iteration of a run, as streamed in MessageType::Sample
+struct Sample {
+    uint32_t iteration;
+    uint64_t launch;
+    uint64_t completion;
+    int64_t queueWait;
+    int64_t launchError;
+
+    void write(Connection& connection) const {
+        connection.send(MessageType::Sample,
+            MessageWriter().u32(iteration).u64(launch).u64(completion).i64(queueWait).i64(launchError));
+    }
+
+    static Sample read(Message const& message) {
+        MessageReader reader(message);
+        Sample sample;
+        sample.iteration = reader.u32();
+        sample.launch = reader.u64();
+        sample.completion = reader.u64();
+        sample.queueWait = reader.i64();
+        sample.launchError = reader.i64();
+        return sample;
+    }
+};
+
+enum class Role : uint32_t { Server = 1, Client, Daemon, Experiment };
+
+// Exchanges Hello messages. False if the peer went away or speaks a version older than we accept;
+// a peer that does not accept ours says so with an Error.
+inline bool handshake(Connection& connection, Role role, uint32_t runs, uint32_t* peerRuns = nullptr) {
+    connection.send(MessageType::Hello, MessageWriter().u32(PROTOCOL_VERSION).u32(runs).u32(static_cast<uint32_t>(role)));
+    Message message;
+    if (!connection.receive(MessageType::Hello, message)) {
+        return false;
+    }
+    MessageReader reader(message);
+    const uint32_t version = reader.u32();
+    const uint32_t theirRuns = reader.u32();
+    if (version < PROTOCOL_MIN_VERSION) {
+        const std::string error = "protocol version " + std::to_string(version) + " is older than "
+            + std::to_string(PROTOCOL_MIN_VERSION);
+        LOG("Protocol: %s\n", error.c_str());
+        connection.send(MessageType::Error, MessageWriter().str(error));
+        connection.flush();
+        return false;
+    }
+    if (peerRuns != nullptr) {
+        *peerRuns = theirRuns;
+    }
+    return true;
+}
@@ -0,0 +1,167 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <time.h>
+
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/*
+    The clock and the blocking waits of the launch loops. HostTimeline is
+    CLOCK_MONOTONIC and the Vulkan device; SimDevice (simdevice.hpp) is a
+    virtual one, so launchWorkloads, the load generator and the launch
+    scheduler run unchanged against the simulated GPU. Threads that wait on a
+    timeline are started with spawn() and joined with join().
+*/
+class Timeline {
+public:
+    virtual ~Timeline() {}
+
+    virtual uint64_t now() = 0;
+    // May wake up late, never early
+    virtual void sleepUntil(uint64_t ns) = 0;
+    virtual void waitForFences(std::vector<VkFence> const& fences) = 0;
+    // Until ready() holds, which another thread of the timeline makes true and then calls notify()
+    virtual void waitFor(std::function<bool()> const& ready) = 0;
+    virtual void notify() = 0;
+    virtual std::thread spawn(std::function<void()> body) = 0;
+    virtual void join(std::thread& thread) = 0;
+};
+
+// Waits block: on the fences, and on a condition variable for waitFor()
+class HostTimeline : public Timeline {
+    VkDevice m_device;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+
+public:
+    explicit HostTimeline(VkDevice device) : m_device(device) {}
+
+    virtual uint64_t now() override {
+        return monotonicNs();
+    }
+
+    virtual void sleepUntil(uint64_t ns) override {
+        struct timespec ts;
+        ts.tv_sec = ns / 1000000000ull;
+        ts.tv_nsec = ns % 1000000000ull;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+        }
+    }
+
+    // Work not done after DEFAULT_FENCE_TIMEOUT is taken for a hung GPU
+    virtual void waitForFences(std::vector<VkFence> const& fences) override {
+        const VkResult result = vkWaitForFences(m_device, fences.size(), fences.data(), VK_TRUE, DEFAULT_FENCE_TIMEOUT);
+        if (result == VK_TIMEOUT) {
+            LOG("Submissions not complete after %llu s, the GPU may be hung\n", DEFAULT_FENCE_TIMEOUT / 1000000000ull);
+            exit(-1);
+        }
+        VK_CHECK_RESULT(result);
+    }
+
+    virtual void waitFor(std::function<bool()> const& ready) override {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, ready);
+    }
+
+    // Taking the mutex orders the change before the check of a waiter that is about to block
+    virtual void notify() override {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_condition.notify_all();
+    }
+
+    virtual std::thread spawn(std::function<void()> body) override {
+        return std::thread(body);
+    }
+
+    virtual void join(std::thread& thread) override {
+        thread.join();
+    }
+};
+
+/*
+    Launches work at absolute deadlines on a timeline. The bulk of the wait
+    is a sleep (clock_nanosleep(TIMER_ABSTIME) on the host), which is woken
+    early by the calibrated wakeup overshoot; the remainder is spent spinning
+    on the clock. The
+    achieved launch error (launch time minus deadline) is kept for every wait.
+*/
+class LaunchScheduler {
+    Timeline& m_timeline;
+    uint64_t m_spinMarginNs;
+    std::vector<int64_t> m_launchErrors;
+
+public:
+    // A virtual timeline wakes up on time and needs no calibration
+    explicit LaunchScheduler(Timeline& timeline, bool calibrated = true) : m_timeline(timeline), m_spinMarginNs(0) {
+        if (calibrated) {
+            calibrate();
+        }
+    }
+
+    // Measure how late clock_nanosleep wakes up and spin for that long plus some slack
+    void calibrate(unsigned samples = 64) {
+        const uint64_t sleepNs = 100000;
+        std::vector<uint64_t> overshoot(samples);
+
+        for (auto& o : overshoot) {
+            const uint64_t deadline = m_timeline.now() + sleepNs;
+            m_timeline.sleepUntil(deadline);
+            o = m_timeline.now() - deadline;
+        }
+        std::sort(overshoot.begin(), overshoot.end());
+
+        // 95th percentile, doubled so an occasional slow wakeup still lands in the spin phase
+        m_spinMarginNs = 2 * overshoot[(samples * 95) / 100];
+        LOG("Launch scheduler: wakeup overshoot median %lu ns, p95 %lu ns, spin margin %lu ns\n",
+            overshoot[samples / 2], overshoot[(samples * 95) / 100], m_spinMarginNs);
+    }
+
+    uint64_t GetSpinMargin() const { return m_spinMarginNs; }
+
+    // Returns the launch time. Deadlines already in the past return immediately and record the lateness.
+    uint64_t waitUntil(uint64_t deadlineNs) {
+        uint64_t now = m_timeline.now();
+
+        if (deadlineNs > now + m_spinMarginNs) {
+            m_timeline.sleepUntil(deadlineNs - m_spinMarginNs);
+            now = m_timeline.now();
+        }
+        while (now < deadlineNs) {
+            cpuRelax();
+            now = m_timeline.now();
+        }
+
+        m_launchErrors.push_back(static_cast<int64_t>(now - deadlineNs));
+        return now;
+    }
+
+    // Records another launch for a deadline waitUntil already reached, e.g. the next submission of a batch
+    void recordLaunch(uint64_t deadlineNs) {
+        m_launchErrors.push_back(static_cast<int64_t>(m_timeline.now() - deadlineNs));
+    }
+
+    std::vector<int64_t> const& GetLaunchErrors() const { return m_launchErrors; }
+};
@@ -0,0 +1,148 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+
+#include <algorithm>
+#include <vector>
+
+/*
+    Finds the smallest low-priority workload that a high-priority one reliably
+    preempts. The size doubles until `required` of `trials` launches show the
+    high-priority interval nested in the low-priority one, then it is bisected
+    between the last failing and the first passing size. The high-priority
+    launch is aimed at a quarter of the low-priority interval, estimated from
+    the last measurement; the measured launch skew between the two sides is
+    fed back into the next offset. Knows nothing about how trials are run.
+*/
+class PreemptionSearch {
+public:
+    struct Config {
+        unsigned trials = 5;            // launches per size
+        unsigned required = 4;          // nested launches for a size to pass
+        unsigned maxCommands = 1u << 24;
+    };
+
+    struct Trial {
+        unsigned lowCommands;
+        uint64_t offsetNs;              // high priority launch after the low priority one
+    };
+
+private:
+    enum class Phase { Grow, Bisect, Done };
+
+    Config m_config;
+    Phase m_phase;
+    unsigned m_commands;
+    unsigned m_failing;                 // largest size known to fail, 0 for none
+    unsigned m_passing;                 // smallest size known to pass, 0 for none
+    unsigned m_trial;
+    unsigned m_nested;
+    double m_nsPerCommand;              // low priority execution, from the last trial
+    int64_t m_correction;               // accumulated launch skew between the sides
+    uint64_t m_offsetNs;
+    std::vector<int64_t> m_waits;       // high priority queue waits of the nested trials of this size
+    std::vector<int64_t> m_passingWaits;
+    uint64_t m_passingOffsetNs;
+    unsigned m_passingNested;
+
+    void finishSize() {
+        const bool pass = m_nested >= m_config.required;
+        if (pass) {
+            m_passing = m_commands;
+            m_passingWaits = m_waits;
+            m_passingOffsetNs = m_offsetNs;
+            m_passingNested = m_nested;
+        } else {
+            m_failing = m_commands;
+        }
+
+        if (m_phase == Phase::Grow && !pass) {
+            if (m_commands >= m_config.maxCommands) {
+                m_phase = Phase::Done;
+            }
+            m_commands = std::min(m_commands * 2, m_config.maxCommands);
+        } else {
+            m_phase = Phase::Bisect;
+            if (m_passing - m_failing <= 1) {
+                m_phase = Phase::Done;
+            }
+            m_commands = m_failing + (m_passing - m_failing) / 2;
+        }
+        m_trial = 0;
+        m_nested = 0;
+        m_waits.clear();
+    }
+
+public:
+    explicit PreemptionSearch(Config const& config)
+        : m_config(config)
+        , m_phase(Phase::Grow)
+        , m_commands(1)
+        , m_failing(0)
+        , m_passing(0)
+        , m_trial(0)
+        , m_nested(0)
+        , m_nsPerCommand(0.0)
+        , m_correction(0)
+        , m_offsetNs(0)
+        , m_passingOffsetNs(0)
+        , m_passingNested(0)
+    {
+        m_config.required = std::min(std::max(m_config.required, 1u), m_config.trials);
+    }
+
+    // The next trial to run, false once the search is over
+    bool next(Trial& trial) {
+        if (m_phase == Phase::Done) {
+            return false;
+        }
+        const int64_t target = static_cast<int64_t>(m_nsPerCommand * m_commands / 4);
+        m_offsetNs = static_cast<uint64_t>(std::max<int64_t>(target + m_correction, 0));
+        trial.lowCommands = m_commands;
+        trial.offsetNs = m_offsetNs;
+        return true;
+    }
+
+    // [launch, completion] of both sides for the trial from next(), and the queue wait of the high priority side
+    void record(const uint64_t high[2], const uint64_t low[2], int64_t highWaitNs) {
+        const bool nested = low[0] < high[0] && low[1] > high[1];
+        if (nested) {
+            m_nested++;
+            m_waits.push_back(highWaitNs);
+        }
+
+        // Aim at the planned offset from the low priority launch actually achieved
+        const int64_t achieved = static_cast<int64_t>(high[0]) - static_cast<int64_t>(low[0]);
+        m_correction += static_cast<int64_t>(m_offsetNs) - achieved;
+        m_nsPerCommand = static_cast<double>(low[1] - low[0]) / m_commands;
+
+        if (++m_trial == m_config.trials) {
+            finishSize();
+        }
+    }
+
+    bool found() const { return m_passing != 0; }
+
+    void report(const char* label) const {
+        if (!found()) {
+            LOG("%s: no preemption up to %u low priority commands\n", label, m_config.maxCommands);
+            return;
+        }
+        int64_t total = 0, minWait = INT64_MAX, maxWait = INT64_MIN;
+        for (int64_t wait : m_passingWaits) {
+            total += wait;
+            minWait = std::min(minWait, wait);
+            maxWait = std::max(maxWait, wait);
+        }
+        LOG("%s: minimal low priority workload %u commands, high priority launched %lu ns after it, %u/%u nested\n",
+            label, m_passing, m_passingOffsetNs, m_passingNested, m_config.trials);
+        LOG("%s: preemption latency (high priority queue wait) mean %ld ns, min %ld ns, max %ld ns\n",
+            label, total / static_cast<int64_t>(m_passingWaits.size()), minWait, maxWait);
+    }
+};
@@ -0,0 +1,268 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+#include "scheduler.hpp"
+#include "simgpu.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/*
+    A Timeline on SimGpu, so the host loops run against the simulated GPU in
+    virtual time. The threads taking part (the bodies given to run() and the
+    threads they spawn) pass a token: only its holder executes, and it hands
+    the token on when it waits. Host work takes no virtual time; the clock
+    only moves, through SimGpu::advance, once every thread waits, to the next
+    completion or the earliest sleep deadline. Of several threads that may go
+    on the lowest numbered one runs first, so every run is deterministic.
+    A fence is the id of the job it signals, plus one.
+*/
+class SimDevice : public Timeline {
+    static const unsigned NONE = UINT32_MAX;
+
+    struct Participant {
+        bool done = false;
+        bool waiting = true;
+        std::function<bool()> ready;        // while waiting
+        uint64_t wakeAt = UINT64_MAX;       // sleep deadline while waiting
+    };
+
+    SimGpu m_gpu;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Participant> m_participants;
+    std::map<std::thread::id, unsigned> m_ids;
+    unsigned m_token = NONE;
+
+    static size_t jobOf(VkFence fence) {
+        return static_cast<size_t>((uintptr_t)fence) - 1;
+    }
+
+    unsigned self() {
+        auto it = m_ids.find(std::this_thread::get_id());
+        if (it == m_ids.end()) {
+            LOG("Sim: a thread outside the simulation waits on it\n");
+            exit(-1);
+        }
+        return it->second;
+    }
+
+    // With m_mutex held: gives the token to the first participant that may go on, advancing virtual
+    // time until there is one. Dropped once every participant is done.
+    void passToken() {
+        while (true) {
+            bool waiting = false;
+            uint64_t wakeAt = UINT64_MAX;
+            for (unsigned p = 0; p < m_participants.size(); p++) {
+                Participant& participant = m_participants[p];
+                if (participant.done || !participant.waiting) {
+                    continue;
+                }
+                if (participant.ready()) {
+                    participant.waiting = false;
+                    m_token = p;
+                    m_condition.notify_all();
+                    return;
+                }
+                waiting = true;
+                wakeAt = std::min(wakeAt, participant.wakeAt);
+            }
+            if (!waiting) {
+                m_token = NONE;
+                m_condition.notify_all();
+                return;
+            }
+            const uint64_t before = m_gpu.now();
+            if (m_gpu.advance(wakeAt).empty() && m_gpu.now() == before) {
+                LOG("Sim: every thread waits on work that never completes\n");
+                exit(-1);
+            }
+        }
+    }
+
+    void block(std::function<bool()> const& ready, uint64_t wakeAt = UINT64_MAX) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const unsigned p = self();
+        m_participants[p].waiting = true;
+        m_participants[p].ready = ready;
+        m_participants[p].wakeAt = wakeAt;
+        passToken();
+        m_condition.wait(lock, [&]() { return m_token == p; });
+    }
+
+public:
+    explicit SimDevice(SimGpu::Config const& config) : m_gpu(config) {}
+
+    SimGpu::Job const& job(VkFence fence) const { return m_gpu.job(jobOf(fence)); }
+
+    // Queued on queue at the current virtual time
+    VkFence submit(unsigned queue, VkQueueGlobalPriorityEXT priority, VkQueueFlagBits engine, uint64_t commands) {
+        return (VkFence)(uintptr_t)(m_gpu.submit(queue, priority, engine, commands) + 1);
+    }
+
+    // Of the jobs submitted to queue so far
+    unsigned preemptions(unsigned queue) const {
+        unsigned count = 0;
+        for (size_t id = 0; id < m_gpu.submitted(); id++) {
+            if (m_gpu.job(id).queue == queue) {
+                count += m_gpu.job(id).preemptions;
+            }
+        }
+        return count;
+    }
+
+    // Runs every body on a thread of its own and returns once all of them are done
+    void run(std::vector<std::function<void()>> const& bodies) {
+        std::vector<std::thread> threads;
+        for (auto const& body : bodies) {
+            threads.push_back(spawn(body));
+        }
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            passToken();
+            m_condition.wait(lock, [&]() { return m_token == NONE; });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    virtual uint64_t now() override {
+        return m_gpu.now();
+    }
+
+    virtual void sleepUntil(uint64_t ns) override {
+        if (ns > m_gpu.now()) {
+            block([this, ns]() { return m_gpu.now() >= ns; }, ns);
+        }
+    }
+
+    virtual void waitForFences(std::vector<VkFence> const& fences) override {
+        waitFor([this, fences]() {
+            for (VkFence fence : fences) {
+                if (!job(fence).complete) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    }
+
+    virtual void waitFor(std::function<bool()> const& ready) override {
+        if (!ready()) {
+            block(ready);
+        }
+    }
+
+    // Every waiter is checked again whenever the token passes
+    virtual void notify() override {}
+
+    // The thread starts once it gets the token
+    virtual std::thread spawn(std::function<void()> body) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const unsigned p = m_participants.size();
+        m_participants.emplace_back();
+        m_participants.back().ready = []() { return true; };
+        std::thread thread([this, p, body]() {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [&]() { return m_token == p; });
+            }
+            body();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_participants[p].done = true;
+            passToken();
+        });
+        m_ids[thread.get_id()] = p;
+        return thread;
+    }
+
+    virtual void join(std::thread& thread) override {
+        unsigned p;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            p = m_ids.at(thread.get_id());
+        }
+        waitFor([this, p]() { return m_participants[p].done; });
+        thread.join();
+    }
+};
+
+/*
+    commands commands per submission on one queue of a SimDevice, in a ring of
+    depth frames like the Vulkan workloads. Its timestamps are the virtual
+    start and end of a submission in ns, so the timestamp period is 1.
+*/
+class SimWorkload : public Workload {
+    SimDevice& m_device;
+    unsigned m_queue;
+    VkQueueGlobalPriorityEXT m_priority;
+    VkQueueFlagBits m_engine;
+    uint64_t m_commands;
+    std::vector<VkFence> m_frames;      // of the latest submission on every frame
+    unsigned m_submitted = 0;
+
+public:
+    SimWorkload(SimDevice& device, unsigned queue, VkQueueGlobalPriorityEXT priority, VkQueueFlagBits engine,
+        uint64_t commands, unsigned depth)
+        : m_device(device)
+        , m_queue(queue)
+        , m_priority(priority)
+        , m_engine(engine)
+        , m_commands(commands)
+        , m_frames(std::max(depth, 1u), VK_NULL_HANDLE)
+    {
+    }
+
+    // There are no command buffers to hand to a submission thread
+    virtual Submission prepareSubmit() override {
+        LOG("Sim: submit:thread is not simulated\n");
+        exit(-1);
+    }
+
+    virtual VkFence submit() override {
+        const unsigned frame = m_submitted++ % m_frames.size();
+        if (m_frames[frame] != VK_NULL_HANDLE) {
+            m_device.waitForFences({ m_frames[frame] });
+        }
+        m_frames[frame] = m_device.submit(m_queue, m_priority, m_engine, m_commands);
+        return m_frames[frame];
+    }
+
+    virtual unsigned depth() const override { return m_frames.size(); }
+    virtual unsigned lastFrame() const override { return (m_submitted + m_frames.size() - 1) % m_frames.size(); }
+
+    virtual void queryTimestamp(unsigned frame, uint64_t time_stamp[], int count) override {
+        SimGpu::Job const& job = m_device.job(m_frames[frame]);
+        for (int i = 0; i < count; i++) {
+            time_stamp[i] = i == 0 ? job.start : job.end;
+        }
+    }
+
+    virtual ProgressCurve queryProgress(unsigned, double) override {
+        return ProgressCurve();
+    }
+
+    virtual PipelineStatistics queryStatistics(unsigned) override {
+        return PipelineStatistics();
+    }
+
+    virtual void waitIdle() override {
+        std::vector<VkFence> fences;
+        for (VkFence fence : m_frames) {
+            if (fence != VK_NULL_HANDLE) {
+                fences.push_back(fence);
+            }
+        }
+        m_device.waitForFences(fences);
+    }
+};
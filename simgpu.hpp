@@ -0,0 +1,290 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+
+#include <algorithm>
+#include <regex>
+#include <string>
+#include <vector>
+
+/*
+    Deterministic model of a GPU with one graphics engine and a configurable
+    number of compute and copy engines, driven by virtual time (ns). Each engine runs
+    the highest-priority ready job; submissions to the same queue run in
+    order. With preemption enabled a running job yields to a higher-priority
+    one at the next multiple of `granularity` commands (the MCBP preemption
+    point). Switching an engine to another queue's context costs switchNs.
+*/
+class SimGpu {
+public:
+    struct Config {
+        uint64_t drawNs = 2000;
+        uint64_t dispatchNs = 1000;
+        uint64_t copyNs = 5000;
+        uint64_t switchNs = 20000;
+        uint64_t granularity = 1;
+        bool preemption = true;
+        unsigned computeEngines = 1;
+        unsigned copyEngines = 1;
+
+        // Time of one command on an engine of type
+        uint64_t commandNs(VkQueueFlagBits type) const {
+            switch (type) {
+            case VK_QUEUE_GRAPHICS_BIT: return drawNs;
+            case VK_QUEUE_TRANSFER_BIT: return copyNs;
+            default: return dispatchNs;
+            }
+        }
+
+        // "gpu=draw_ns:2000,dispatch_ns:1000,copy_ns:5000,switch_ns:20000,granularity:1,preempt:1,compute_engines:1,copy_engines:1",
+        // any subset
+        static Config parse(const char* str) {
+            static const std::regex regex_gpu("gpu=([a-z_]+:[0-9]+(,[a-z_]+:[0-9]+)*)?");
+            static const std::regex regex_item("([a-z_]+):([0-9]+)");
+            Config config;
+            std::cmatch m;
+
+            if (!std::regex_match(str, m, regex_gpu)) {
+                LOG("Could not parse \'%s\'\n", str);
+                exit(-1);
+            }
+            const std::string items = m[1];
+            for (std::sregex_iterator it(items.begin(), items.end(), regex_item), end; it != end; ++it) {
+                const std::string key = (*it)[1];
+                const uint64_t value = std::stoull((*it)[2]);
+                if (key == "draw_ns") {
+                    config.drawNs = value;
+                } else if (key == "dispatch_ns") {
+                    config.dispatchNs = value;
+                } else if (key == "copy_ns") {
+                    config.copyNs = value;
+                } else if (key == "switch_ns") {
+                    config.switchNs = value;
+                } else if (key == "granularity") {
+                    config.granularity = std::max<uint64_t>(value, 1);
+                } else if (key == "preempt") {
+                    config.preemption = value != 0;
+                } else if (key == "compute_engines") {
+                    config.computeEngines = std::max<unsigned>(value, 1);
+                } else if (key == "copy_engines") {
+                    config.copyEngines = std::max<unsigned>(value, 1);
+                } else {
+                    LOG("%s is not a valid gpu option\n", key.c_str());
+                    exit(-1);
+                }
+            }
+            return config;
+        }
+    };
+
+    struct Job {
+        unsigned queue;                 // submissions to one queue execute in order
+        VkQueueGlobalPriorityEXT priority;
+        VkQueueFlagBits engine;
+        uint64_t commands;
+        uint64_t commandNs;
+        uint64_t submit = 0;
+        uint64_t start = 0;
+        uint64_t end = 0;
+        uint64_t done = 0;
+        unsigned preemptions = 0;
+        bool started = false;
+        bool complete = false;
+    };
+
+private:
+    static const size_t NONE = SIZE_MAX;
+
+    struct Engine {
+        VkQueueFlagBits type;
+        size_t job = NONE;
+        uint64_t readyAt = 0;           // end of the context switch, commands execute from here
+        uint64_t doneAtStart = 0;
+        uint64_t preemptAt = UINT64_MAX;
+        unsigned context = UINT32_MAX;  // queue whose context is loaded
+    };
+
+    Config m_config;
+    uint64_t m_now;
+    std::vector<Job> m_jobs;
+    std::vector<Engine> m_engines;
+
+    uint64_t completionTime(Engine const& engine) const {
+        Job const& job = m_jobs[engine.job];
+        return engine.readyAt + (job.commands - engine.doneAtStart) * job.commandNs;
+    }
+
+    uint64_t executedAt(Engine const& engine, uint64_t time) const {
+        Job const& job = m_jobs[engine.job];
+        if (time <= engine.readyAt || job.commandNs == 0) {
+            return engine.doneAtStart;
+        }
+        return std::min(job.commands, engine.doneAtStart + (time - engine.readyAt) / job.commandNs);
+    }
+
+    // Only the oldest unfinished job of a queue may run, and not while another engine runs it
+    bool eligible(size_t id) const {
+        Job const& job = m_jobs[id];
+        if (job.complete) {
+            return false;
+        }
+        for (size_t i = 0; i < id; i++) {
+            if (m_jobs[i].queue == job.queue && !m_jobs[i].complete) {
+                return false;
+            }
+        }
+        for (auto const& engine : m_engines) {
+            if (engine.job == id) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Highest priority first, then submission order
+    size_t pick(VkQueueFlagBits type) const {
+        size_t best = NONE;
+        for (size_t id = 0; id < m_jobs.size(); id++) {
+            if (m_jobs[id].engine == type && eligible(id)
+                && (best == NONE || m_jobs[id].priority > m_jobs[best].priority)) {
+                best = id;
+            }
+        }
+        return best;
+    }
+
+    void schedule() {
+        for (auto& engine : m_engines) {
+            if (engine.job == NONE) {
+                engine.job = pick(engine.type);
+                if (engine.job == NONE) {
+                    continue;
+                }
+                Job& job = m_jobs[engine.job];
+                engine.readyAt = m_now + (engine.context != job.queue ? m_config.switchNs : 0);
+                engine.doneAtStart = job.done;
+                engine.preemptAt = UINT64_MAX;
+                engine.context = job.queue;
+                if (!job.started) {
+                    job.started = true;
+                    job.start = engine.readyAt;
+                }
+                continue;
+            }
+
+            if (!m_config.preemption || engine.preemptAt != UINT64_MAX) {
+                continue;
+            }
+            const size_t waiting = pick(engine.type);
+            Job const& job = m_jobs[engine.job];
+            if (waiting == NONE || m_jobs[waiting].priority <= job.priority) {
+                continue;
+            }
+            // Finish the command in flight, then run on to the next preemption point
+            uint64_t position = executedAt(engine, m_now);
+            if (m_now > engine.readyAt && job.commandNs && (m_now - engine.readyAt) % job.commandNs) {
+                position++;
+            }
+            const uint64_t boundary = ((position + m_config.granularity - 1) / m_config.granularity) * m_config.granularity;
+            if (boundary < job.commands) {
+                engine.preemptAt = engine.readyAt + (boundary - engine.doneAtStart) * job.commandNs;
+            }
+        }
+    }
+
+public:
+    explicit SimGpu(Config const& config)
+        : m_config(config)
+        , m_now(0)
+    {
+        Engine graphics;
+        graphics.type = VK_QUEUE_GRAPHICS_BIT;
+        m_engines.push_back(graphics);
+        for (unsigned i = 0; i < config.computeEngines; i++) {
+            Engine compute;
+            compute.type = VK_QUEUE_COMPUTE_BIT;
+            m_engines.push_back(compute);
+        }
+        for (unsigned i = 0; i < config.copyEngines; i++) {
+            Engine copy;
+            copy.type = VK_QUEUE_TRANSFER_BIT;
+            m_engines.push_back(copy);
+        }
+    }
+
+    Config const& GetConfig() const { return m_config; }
+    uint64_t now() const { return m_now; }
+    Job const& job(size_t id) const { return m_jobs[id]; }
+    size_t submitted() const { return m_jobs.size(); }
+
+    // Queued at the current virtual time, returns the job id
+    size_t submit(unsigned queue, VkQueueGlobalPriorityEXT priority, VkQueueFlagBits engine, uint64_t commands) {
+        Job job;
+        job.queue = queue;
+        job.priority = priority;
+        job.engine = engine;
+        job.commands = commands;
+        job.commandNs = m_config.commandNs(engine);
+        job.submit = m_now;
+        m_jobs.push_back(job);
+        return m_jobs.size() - 1;
+    }
+
+    bool idle() const {
+        for (auto const& job : m_jobs) {
+            if (!job.complete) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Runs until the first completion or until `until`, whichever comes first.
+    // Returns the jobs completed at the new current time.
+    std::vector<size_t> advance(uint64_t until) {
+        std::vector<size_t> completed;
+
+        while (completed.empty()) {
+            schedule();
+
+            uint64_t next = UINT64_MAX;
+            for (auto const& engine : m_engines) {
+                if (engine.job != NONE) {
+                    next = std::min(next, std::min(completionTime(engine), engine.preemptAt));
+                }
+            }
+            if (next == UINT64_MAX || next > until) {
+                if (until != UINT64_MAX) {
+                    m_now = std::max(m_now, until);
+                }
+                break;
+            }
+            m_now = next;
+
+            for (auto& engine : m_engines) {
+                if (engine.job == NONE) {
+                    continue;
+                }
+                Job& job = m_jobs[engine.job];
+                if (completionTime(engine) == m_now) {
+                    job.done = job.commands;
+                    job.end = m_now;
+                    job.complete = true;
+                    completed.push_back(engine.job);
+                    engine.job = NONE;
+                } else if (engine.preemptAt == m_now) {
+                    job.done = executedAt(engine, m_now);
+                    job.preemptions++;
+                    engine.job = NONE;
+                }
+            }
+        }
+        return completed;
+    }
+};
@@ -0,0 +1,194 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include "VulkanTools.h"
+#include "base.hpp"
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <semaphore.h>
+
+/*
+    Unbounded multi-producer single-consumer queue (Vyukov). A push is one
+    atomic exchange plus one store, so producers never wait on each other or
+    on the consumer. The consumer may briefly see an empty queue while a push
+    is in progress; it simply retries.
+*/
+template <typename T>
+class MpscQueue {
+    struct Node {
+        std::atomic<Node*> next;
+        T value;
+    };
+
+    std::atomic<Node*> m_head;
+    Node* m_tail;
+    Node m_stub;
+
+public:
+    MpscQueue() : m_head(&m_stub), m_tail(&m_stub) {
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~MpscQueue() {
+        T value;
+        while (pop(value)) {
+        }
+        if (m_tail != &m_stub) {
+            delete m_tail;
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(const T& value) {
+        Node* node = new Node;
+        node->next.store(nullptr, std::memory_order_relaxed);
+        node->value = value;
+        Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // Single consumer only
+    bool empty() const {
+        return m_tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+    // Single consumer only
+    bool pop(T& value) {
+        Node* tail = m_tail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
+        }
+        value = next->value;
+        m_tail = next;
+        if (tail != &m_stub) {
+            delete tail;
+        }
+        return true;
+    }
+};
+
+/*
+    Owns the only thread allowed to call vkQueueSubmit on one VkQueue.
+    Producers hand over prepared submissions and return immediately; the
+    submission thread issues them in push order and records when each one
+    was enqueued and when vkQueueSubmit returned.
+*/
+class Submitter {
+    static const unsigned SPIN_COUNT = 4096;
+
+    VkQueue m_queue;
+    MpscQueue<Submission> m_pending;
+    std::vector<Submission> m_history;
+    std::atomic<uint64_t> m_enqueued;
+    std::atomic<uint64_t> m_submitted;
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_parked;
+    sem_t m_wakeup;
+    std::function<void()> m_threadInit;
+    std::thread m_thread;
+
+    void run() {
+        unsigned idle = 0;
+
+        if (m_threadInit) {
+            m_threadInit();
+        }
+        Submission submission;
+
+        while (true) {
+            if (m_pending.pop(submission)) {
+                idle = 0;
+                VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+                submitInfo.commandBufferCount = 1;
+                submitInfo.pCommandBuffers = &submission.commandBuffer;
+                VK_CHECK_RESULT(vkQueueSubmit(m_queue, 1, &submitInfo, submission.fence));
+                submission.submitTime = monotonicNs();
+                m_history.push_back(submission);
+                m_submitted.fetch_add(1, std::memory_order_release);
+                continue;
+            }
+
+            if (!m_running.load(std::memory_order_acquire)
+                && m_submitted.load(std::memory_order_relaxed) == m_enqueued.load(std::memory_order_acquire)) {
+                return;
+            }
+
+            // Spin for a short while before parking, a push usually follows shortly
+            if (++idle < SPIN_COUNT) {
+                continue;
+            }
+            idle = 0;
+            m_parked.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!m_pending.empty() || !m_running.load()) {
+                m_parked.store(false);
+                continue;
+            }
+            sem_wait(&m_wakeup);
+        }
+    }
+
+public:
+    // threadInit runs first on the submission thread, e.g. to set its affinity
+    explicit Submitter(VkQueue queue, std::function<void()> threadInit = nullptr)
+        : m_queue(queue)
+        , m_enqueued(0)
+        , m_submitted(0)
+        , m_running(true)
+        , m_parked(false)
+        , m_threadInit(threadInit)
+    {
+        sem_init(&m_wakeup, 0, 0);
+        m_thread = std::thread(&Submitter::run, this);
+    }
+
+    ~Submitter() {
+        m_running.store(false, std::memory_order_release);
+        sem_post(&m_wakeup);
+        m_thread.join();
+        sem_destroy(&m_wakeup);
+    }
+
+    Submitter(const Submitter&) = delete;
+    Submitter& operator=(const Submitter&) = delete;
+
+    VkQueue GetQueue() const { return m_queue; }
+
+    // Safe to call from any number of threads. Returns the fence the submission will signal.
+    VkFence push(Submission submission) {
+        submission.queue = m_queue;
+        submission.enqueueTime = monotonicNs();
+        m_enqueued.fetch_add(1, std::memory_order_release);
+        m_pending.push(submission);
+        // Only enter the kernel when the submission thread has gone to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_parked.exchange(false)) {
+            sem_post(&m_wakeup);
+        }
+        return submission.fence;
+    }
+
+    // Blocks until every pushed submission has returned from vkQueueSubmit.
+    // Afterwards the caller may use the queue directly and read the history.
+    void drain() {
+        while (m_submitted.load(std::memory_order_acquire) != m_enqueued.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    // Submissions in the order they were issued. Only valid after drain().
+    std::vector<Submission> const& GetHistory() const { return m_history; }
+};
@@ -0,0 +1,181 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    Work-stealing thread pool. Every worker owns a deque: tasks submitted from
+    a worker go to its own deque and are taken back LIFO, other workers steal
+    FIFO from the opposite end. Tasks submitted from outside the pool are
+    spread round-robin. Idle workers sleep until something is queued.
+*/
+class ThreadPool {
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::atomic<bool> m_running;
+    std::atomic<unsigned> m_next;
+    std::atomic<int> m_queued;
+    std::mutex m_idleMutex;
+    std::condition_variable m_idle;
+
+    // Index of the worker running on this thread, -1 outside the pool
+    static int& currentWorker() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    bool pop(unsigned index, bool own, std::function<void()>& task) {
+        Worker& worker = *m_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) {
+            return false;
+        }
+        if (own) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        } else {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void run(unsigned index) {
+        currentWorker() = index;
+        while (true) {
+            if (runOne()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_idleMutex);
+            m_idle.wait(lock, [this]() { return m_queued.load() > 0 || !m_running.load(); });
+            if (!m_running.load() && m_queued.load() == 0) {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency())
+        : m_running(true)
+        , m_next(0)
+        , m_queued(0)
+    {
+        threads = std::max(threads, 1u);
+        for (unsigned i = 0; i < threads; i++) {
+            m_workers.emplace_back(new Worker);
+        }
+        for (unsigned i = 0; i < threads; i++) {
+            m_threads.emplace_back(&ThreadPool::run, this, i);
+        }
+    }
+
+    // Queued tasks are still run before the workers exit
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_idleMutex);
+            m_running.store(false);
+        }
+        m_idle.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return m_workers.size(); }
+
+    void submit(std::function<void()> task) {
+        const int self = currentWorker();
+        const unsigned index = self >= 0 ? self : m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+        {
+            std::lock_guard<std::mutex> lock(m_workers[index]->mutex);
+            m_workers[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_idleMutex);
+            m_queued.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_idle.notify_one();
+    }
+
+    // Runs one task, our own first and then stolen. Returns false if there was nothing to run.
+    bool runOne() {
+        const int self = currentWorker();
+        std::function<void()> task;
+
+        if (self >= 0 && pop(self, true, task)) {
+            task();
+            return true;
+        }
+        const unsigned start = self >= 0 ? self + 1 : 0;
+        for (unsigned i = 0; i < m_workers.size(); i++) {
+            const unsigned victim = (start + i) % m_workers.size();
+            if (victim != static_cast<unsigned>(self) && pop(victim, false, task)) {
+                task();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/*
+    A set of tasks to wait for. wait() runs queued tasks on the calling
+    thread instead of blocking, so groups may be nested inside pool tasks.
+    Without a pool every task runs inline in run(), in order.
+*/
+class TaskGroup {
+    ThreadPool* m_pool;
+    std::atomic<unsigned> m_outstanding;
+
+public:
+    explicit TaskGroup(ThreadPool* pool) : m_pool(pool), m_outstanding(0) {}
+
+    ~TaskGroup() {
+        wait();
+    }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> task) {
+        if (m_pool == nullptr) {
+            task();
+            return;
+        }
+        m_outstanding.fetch_add(1, std::memory_order_relaxed);
+        m_pool->submit([this, task]() {
+            task();
+            m_outstanding.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    void wait() {
+        while (m_outstanding.load(std::memory_order_acquire) != 0) {
+            if (!m_pool->runOne()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
@@ -0,0 +1,394 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+#include "base.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*
+    Options of a TransferWork. kind is buffer for vkCmdCopyBuffer into a device local buffer
+    or image for vkCmdCopyBufferToImage into an optimally tiled RGBA8 image, both from a host
+    visible staging buffer as uploads do. Every copy command moves size bytes split into
+    regions regions, so many small regions and a few large ones compare at the same size.
+    frames and progressInterval are as for ComputeWork.
+*/
+struct TransferConfig {
+    enum class Kind { Buffer, Image };
+
+    Kind kind = Kind::Buffer;
+    VkDeviceSize size = 16 << 20;
+    uint32_t regions = 1;
+    uint32_t frames = 1;
+    uint32_t progressInterval = 0;
+
+    // buffer or image
+    static bool parseKind(const std::string& str, Kind& kind) {
+        if (str == "buffer") {
+            kind = Kind::Buffer;
+        } else if (str == "image") {
+            kind = Kind::Image;
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
+
+/*
+    Copy traffic on a transfer queue, from a transfer-only family (DMA engine) when the device
+    has one with timestamps, otherwise from a graphics or compute family. An image larger than
+    the device supports is spread across array layers. A barrier between the copy commands
+    keeps them in order, so like the draws and dispatches of the other workloads every one is
+    a point where the queue can be switched.
+    The copied data is not verified, only the timing matters.
+*/
+class TransferWork : public Workload {
+    static const uint32_t IMAGE_WIDTH = 4096;   // texels per row of the destination image
+
+    VkDevice device;
+    VkPhysicalDevice physicalDevice;
+    VkQueue queue;
+    MemoryTracker* memoryTracker;
+    unsigned memoryOwner;
+    VkCommandPool commandPool;
+    FrameRing frames;
+    ProgressMarks progress;
+    TransferConfig::Kind kind;
+    VkDeviceSize bytes;                 // per copy command
+    VkExtent2D imageExtent = {};
+    uint32_t imageLayers = 1;
+
+    VkBuffer stagingBuffer = VK_NULL_HANDLE, dstBuffer = VK_NULL_HANDLE;
+    VkImage dstImage = VK_NULL_HANDLE;
+    VkDeviceMemory stagingMemory = VK_NULL_HANDLE, dstMemory = VK_NULL_HANDLE;
+    std::vector<VkBufferCopy> bufferRegions;
+    std::vector<VkBufferImageCopy> imageRegions;
+    unsigned copyCount;
+    unsigned submissions = 0;
+
+    VkDeviceMemory allocate(VkMemoryRequirements const& requirements, VkMemoryPropertyFlags properties) {
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+        VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+        memAlloc.allocationSize = requirements.size;
+        bool found = false;
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount && !found; i++) {
+            if ((requirements.memoryTypeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                memAlloc.memoryTypeIndex = i;
+                found = true;
+            }
+        }
+        if (!found) {
+            LOG("No memory type with properties %08x for the transfer\n", properties);
+            exit(-1);
+        }
+        VkDeviceMemory memory;
+        VK_CHECK_RESULT(memoryTracker->allocate(device, memAlloc, &memory, memoryOwner));
+        return memory;
+    }
+
+    // Host visible source, filled once
+    void createStaging() {
+        VkBufferCreateInfo bufferInfo = vks::initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, bytes);
+        VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &stagingBuffer));
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, stagingBuffer, &requirements);
+        stagingMemory = allocate(requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        VK_CHECK_RESULT(vkBindBufferMemory(device, stagingBuffer, stagingMemory, 0));
+
+        void* mapped;
+        VK_CHECK_RESULT(vkMapMemory(device, stagingMemory, 0, bytes, 0, &mapped));
+        memset(mapped, 0x5a, bytes);
+        vkUnmapMemory(device, stagingMemory);
+    }
+
+    // Buffer regions of equal size, 4 byte aligned
+    void createDstBuffer(uint32_t regions) {
+        VkBufferCreateInfo bufferInfo = vks::initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_DST_BIT, bytes);
+        VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &dstBuffer));
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, dstBuffer, &requirements);
+        dstMemory = allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK_RESULT(vkBindBufferMemory(device, dstBuffer, dstMemory, 0));
+
+        regions = std::max<VkDeviceSize>(std::min<VkDeviceSize>(regions, bytes / 4), 1);
+        const VkDeviceSize regionSize = (bytes / regions) & ~VkDeviceSize(3);
+        for (uint32_t r = 0; r < regions; r++) {
+            VkBufferCopy region = {};
+            region.srcOffset = region.dstOffset = r * regionSize;
+            region.size = r + 1 == regions ? bytes - r * regionSize : regionSize;
+            bufferRegions.push_back(region);
+        }
+    }
+
+    struct ImageLayout {
+        VkExtent2D extent;
+        uint32_t layers;
+        VkDeviceSize bytes;
+    };
+
+    // Bytes per copy command, whole RGBA8 texels
+    static VkDeviceSize copyBytes(TransferConfig const& config) {
+        return std::max<VkDeviceSize>(config.size, 4) & ~VkDeviceSize(3);
+    }
+
+    // Rows of up to IMAGE_WIDTH texels, the last one filled up, spread evenly over as many layers of up to
+    // the largest supported height as it takes, so every copy is rounded up by less than a row per layer.
+    // False, and why, when even all layers are not enough.
+    static bool layoutImage(VkPhysicalDevice physicalDevice, VkDeviceSize bytes, ImageLayout& layout, std::string* why) {
+        VkImageFormatProperties properties;
+        VK_CHECK_RESULT(vkGetPhysicalDeviceImageFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM,
+            VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, 0, &properties));
+        const VkDeviceSize texels = bytes / 4;
+        layout.extent.width = static_cast<uint32_t>(std::min<VkDeviceSize>(texels,
+            std::min(uint32_t(IMAGE_WIDTH), properties.maxExtent.width)));
+        const VkDeviceSize rows = (texels + layout.extent.width - 1) / layout.extent.width;
+        const VkDeviceSize layers = (rows + properties.maxExtent.height - 1) / properties.maxExtent.height;
+        layout.extent.height = static_cast<uint32_t>((rows + layers - 1) / layers);
+        layout.bytes = VkDeviceSize(layout.extent.width) * layout.extent.height * layers * 4;
+        if (layers > properties.maxArrayLayers || layout.bytes > properties.maxResourceSize) {
+            if (why) {
+                char text[256];
+                snprintf(text, sizeof(text), "%lu bytes do not fit an image, the device takes up to %u layers of "
+                    "%ux%u RGBA8 texels and %lu bytes. Use a smaller size:N or copy:buffer", (unsigned long)bytes,
+                    properties.maxArrayLayers, layout.extent.width, properties.maxExtent.height,
+                    (unsigned long)properties.maxResourceSize);
+                *why = text;
+            }
+            return false;
+        }
+        layout.layers = static_cast<uint32_t>(layers);
+        return true;
+    }
+
+    // Lays out the destination image and logs when that rounds the copy size up
+    void sizeImage() {
+        ImageLayout layout;
+        std::string why;
+        if (!layoutImage(physicalDevice, bytes, layout, &why)) {
+            LOG("Transfer: %s\n", why.c_str());
+            exit(-1);
+        }
+        if (layout.bytes != bytes) {
+            LOG("Transfer: size:%lu rounded up to %lu bytes, %u row(s) of %u texels in %u layer(s)\n",
+                (unsigned long)bytes, (unsigned long)layout.bytes, layout.extent.height, layout.extent.width,
+                layout.layers);
+        }
+        imageExtent = layout.extent;
+        imageLayers = layout.layers;
+        bytes = layout.bytes;
+    }
+
+    // Bands of whole rows, across all layers; on transfer-only queues band starts are multiples of the
+    // queue's image transfer granularity, with no granularity only the whole image can be copied
+    void createDstImage(uint32_t regions, VkExtent3D granularity) {
+        VkImageCreateInfo imageInfo = vks::initializers::imageCreateInfo();
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        imageInfo.extent = { imageExtent.width, imageExtent.height, 1 };
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = imageLayers;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VK_CHECK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &dstImage));
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device, dstImage, &requirements);
+        dstMemory = allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK_RESULT(vkBindImageMemory(device, dstImage, dstMemory, 0));
+
+        const uint32_t alignment = granularity.height ? granularity.height : imageExtent.height;
+        regions = std::max(std::min(regions, (imageExtent.height + alignment - 1) / alignment), 1u);
+        uint32_t start = 0;
+        for (uint32_t r = 0; r < regions && start < imageExtent.height; r++) {
+            uint32_t end = r + 1 == regions ? imageExtent.height
+                : static_cast<uint32_t>(uint64_t(r + 1) * imageExtent.height / regions) / alignment * alignment;
+            end = std::min(std::max(end, start + alignment), imageExtent.height);
+            // Layer l of the band follows a whole layer of the staging buffer after layer l - 1
+            VkBufferImageCopy region = {};
+            region.bufferOffset = VkDeviceSize(start) * imageExtent.width * 4;
+            region.bufferImageHeight = imageExtent.height;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.layerCount = imageLayers;
+            region.imageOffset = { 0, static_cast<int32_t>(start), 0 };
+            region.imageExtent = { imageExtent.width, end - start, 1 };
+            imageRegions.push_back(region);
+            start = end;
+        }
+    }
+
+    void recordCommands(FrameRing::Frame const& frame) {
+        const VkCommandBuffer commandBuffer = frame.commandBuffer;
+        const VkQueryPool queryPool = frame.queryPool;
+
+        VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+        VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+        if (!frames.hostQueryReset()) {
+            vkCmdResetQueryPool(commandBuffer, queryPool, 0, frames.queries());
+        }
+
+        if (dstImage != VK_NULL_HANDLE) {
+            // The contents are overwritten, only the copies of earlier submissions have to finish first
+            VkImageMemoryBarrier imageBarrier = vks::initializers::imageMemoryBarrier();
+            imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageBarrier.image = dstImage;
+            imageBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, imageLayers };
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_FLAGS_NONE, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+        }
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        for (unsigned i = 0; i < copyCount; i++) {
+            if (i > 0) {
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+            }
+            if (dstImage != VK_NULL_HANDLE) {
+                vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    static_cast<uint32_t>(imageRegions.size()), imageRegions.data());
+            } else {
+                vkCmdCopyBuffer(commandBuffer, stagingBuffer, dstBuffer,
+                    static_cast<uint32_t>(bufferRegions.size()), bufferRegions.data());
+            }
+            progress.write(commandBuffer, queryPool, i);
+        }
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+
+        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+    }
+
+public:
+    // Whether the queue can time the copies of config and the device holds their destination, else why not
+    static bool supports(Base& base, QueueInfo const& queueInfo, TransferConfig const& config, std::string* why) {
+        // Base only picks a family without timestamps when no family has them
+        if (queueInfo.timestampValidBits == 0) {
+            if (why) {
+                *why = "No queue family has timestamps, transfers cannot be timed";
+            }
+            return false;
+        }
+        ImageLayout layout;
+        if (config.kind == TransferConfig::Kind::Image && !layoutImage(base.GetPhysicalDevice(), copyBytes(config), layout, why)) {
+            if (why) {
+                *why = "Transfer: " + *why;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    // commandCount copy commands per submission
+    TransferWork(Base& base, QueueInfo queueInfo, unsigned commandCount = 1,
+        TransferConfig const& config = TransferConfig())
+        : kind(config.kind)
+        , copyCount(commandCount)
+    {
+        device = base.GetDevice();
+        physicalDevice = base.GetPhysicalDevice();
+        queue = queueInfo.queue;
+        memoryTracker = &base.GetMemoryTracker();
+        memoryOwner = memoryTracker->addOwner("transfer priority " + std::to_string(queueInfo.priority));
+
+        std::string why;
+        if (!supports(base, queueInfo, config, &why)) {
+            LOG("%s\n", why.c_str());
+            exit(-1);
+        }
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+        VkCommandPoolCreateInfo cmdPoolInfo = {};
+        cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolInfo.queueFamilyIndex = queueInfo.familyIndex;
+        cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
+        progress.interval = config.progressInterval;
+        progress.commandCount = commandCount;
+        frames.create(device, commandPool, config.frames, progress.queries(), base.GetHostQueryReset());
+
+        bytes = copyBytes(config);
+        if (kind == TransferConfig::Kind::Image) {
+            sizeImage();
+            createDstImage(config.regions, families[queueInfo.familyIndex].minImageTransferGranularity);
+        } else {
+            createDstBuffer(config.regions);
+        }
+        createStaging();
+
+        LOG("Transfer: %u %s copies of %lu bytes in %zu region(s) on family %u (flags %08x)\n", copyCount,
+            kind == TransferConfig::Kind::Image ? "buffer to image" : "buffer to buffer", (unsigned long)bytes,
+            kind == TransferConfig::Kind::Image ? imageRegions.size() : bufferRegions.size(),
+            queueInfo.familyIndex, families[queueInfo.familyIndex].queueFlags);
+        if (kind == TransferConfig::Kind::Image) {
+            LOG("Transfer: image of %ux%u texels in %u layer(s)\n", imageExtent.width, imageExtent.height, imageLayers);
+        }
+
+        for (auto& frame : frames) {
+            recordCommands(frame);
+        }
+    }
+
+    virtual Submission prepareSubmit() override {
+        const unsigned frame = frames.acquire();
+        submissions++;
+
+        Submission submission = {};
+        submission.queue = queue;
+        submission.commandBuffer = frames[frame].commandBuffer;
+        submission.fence = frames[frame].fence;
+        return submission;
+    }
+
+    virtual unsigned depth() const override { return frames.depth(); }
+    virtual unsigned lastFrame() const override { return frames.last(); }
+
+    virtual void queryTimestamp(unsigned frame, uint64_t time_stamp[], int count) override {
+        VK_CHECK_RESULT(vkGetQueryPoolResults(device, frames[frame].queryPool, 0, count,
+            sizeof(uint64_t)*count, time_stamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+    }
+
+    virtual ProgressCurve queryProgress(unsigned frame, double timestampPeriod) override {
+        return ProgressCurve::collect(device, frames[frame].queryPool, progress, timestampPeriod);
+    }
+
+    // Transfer queues have no pipeline statistics
+    virtual PipelineStatistics queryStatistics(unsigned) override {
+        return PipelineStatistics();
+    }
+
+    virtual void waitIdle() override {
+        frames.wait();
+        LOG("Transfer: %u submission(s), %lu bytes copied\n", submissions,
+            (unsigned long)(VkDeviceSize(submissions) * copyCount * bytes));
+    }
+
+    ~TransferWork() {
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkDestroyBuffer(device, dstBuffer, nullptr);
+        vkDestroyImage(device, dstImage, nullptr);
+        memoryTracker->free(device, stagingMemory);
+        memoryTracker->free(device, dstMemory);
+        memoryTracker->releaseOwner(memoryOwner);
+        vkDestroyCommandPool(device, commandPool, nullptr);
+    }
+};
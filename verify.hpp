@@ -0,0 +1,94 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define VERIFY_HAVE_AVX2 1
+#endif
+
+struct VerifyResult {
+    size_t mismatches = 0;
+    size_t firstMismatch = SIZE_MAX;
+    uint64_t checksum = 0;      // sum of all output elements, the same for every implementation
+    bool simd = false;
+};
+
+/*
+    Checks output[i] == input[i] + increment, the result of the increment
+    kernel run `increment` times. Compares eight elements at a time with
+    AVX2 when the CPU has it and falls back to scalar code otherwise.
+*/
+class Verifier {
+    static void scalar(const uint32_t* input, const uint32_t* output, size_t begin, size_t end,
+        uint32_t increment, VerifyResult& result) {
+        for (size_t i = begin; i < end; i++) {
+            if (output[i] != input[i] + increment) {
+                if (result.mismatches++ == 0) {
+                    result.firstMismatch = i;
+                }
+            }
+            result.checksum += output[i];
+        }
+    }
+
+#ifdef VERIFY_HAVE_AVX2
+    __attribute__((target("avx2")))
+    static void avx2(const uint32_t* input, const uint32_t* output, size_t count,
+        uint32_t increment, VerifyResult& result) {
+        const __m256i add = _mm256_set1_epi32(increment);
+        __m256i sum = _mm256_setzero_si256();
+        size_t i = 0;
+
+        for (; i + 8 <= count; i += 8) {
+            const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+            const __m256i out = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(output + i));
+            const unsigned equal = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_add_epi32(in, add), out)));
+            if (equal != 0xff) {
+                if (result.mismatches == 0) {
+                    result.firstMismatch = i + __builtin_ctz(~equal & 0xff);
+                }
+                result.mismatches += 8 - __builtin_popcount(equal);
+            }
+            // Widen to 64 bit lanes so the checksum cannot wrap early
+            sum = _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(out)));
+            sum = _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(out, 1)));
+        }
+
+        uint64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+        result.checksum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        scalar(input, output, i, count, increment, result);
+    }
+#endif
+
+public:
+    static bool hasAvx2() {
+#ifdef VERIFY_HAVE_AVX2
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    static VerifyResult increment(const uint32_t* input, const uint32_t* output, size_t count, uint32_t increment,
+        bool allowSimd = true) {
+        VerifyResult result;
+#ifdef VERIFY_HAVE_AVX2
+        if (allowSimd && hasAvx2()) {
+            result.simd = true;
+            avx2(input, output, count, increment, result);
+            return result;
+        }
+#endif
+        scalar(input, output, 0, count, increment, result);
+        return result;
+    }
+};
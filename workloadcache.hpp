@@ -0,0 +1,72 @@
+/*
+ * *
+ * * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * *
+ * */
+
+#pragma once
+
+#include "base.hpp"
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+    Recorded workloads kept for reuse, keyed by whatever describes how they
+    were built. The least recently used entry is destroyed when the cache is
+    full, so its workloads must be idle by then.
+*/
+class WorkloadCache {
+    struct Entry {
+        std::string key;
+        std::vector<std::unique_ptr<Workload>> workloads;
+    };
+
+    std::list<Entry> m_entries;     // most recently used first
+    size_t m_capacity;
+    uint64_t m_hits;
+    uint64_t m_misses;
+
+public:
+    explicit WorkloadCache(size_t capacity)
+        : m_capacity(std::max<size_t>(capacity, 1))
+        , m_hits(0)
+        , m_misses(0)
+    {}
+
+    // The workloads cached under key, made by build() on a miss. The cache owns them.
+    std::vector<Workload*> get(std::string const& key, std::function<std::vector<Workload*>()> const& build, bool* hit) {
+        std::vector<Workload*> workloads;
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (it->key == key) {
+                m_entries.splice(m_entries.begin(), m_entries, it);
+                for (auto const& workload : m_entries.front().workloads) {
+                    workloads.push_back(workload.get());
+                }
+                m_hits++;
+                *hit = true;
+                return workloads;
+            }
+        }
+
+        m_misses++;
+        *hit = false;
+        if (m_entries.size() == m_capacity) {
+            m_entries.pop_back();
+        }
+        workloads = build();
+        m_entries.push_front(Entry());
+        m_entries.front().key = key;
+        for (auto workload : workloads) {
+            m_entries.front().workloads.emplace_back(workload);
+        }
+        return workloads;
+    }
+
+    size_t size() const { return m_entries.size(); }
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+};